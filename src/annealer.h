@@ -16,22 +16,101 @@
  *
  */
 
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
 #include <functional>
-#include <iostream>
+#include <istream>
+#include <limits>
+#include <optional>
+#include <ostream>
 #include <random>
+#include <sstream>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "./asyncwriter.h"
+#include "./threadpool.h"
 
 namespace bluenoise
 {
 
 /**
- * Annealer, a simulated-annealing optimizing class
+ * Statistics of an annealing run, sampled between exchange rounds
+ * Energies and temperature are those of the chain at the base temperature.
+ */
+struct AnnealingStats
+{
+    size_t iteration{0};             //!< Number of iterations done
+    size_t iterationCount{0};        //!< Total number of iterations of the run
+    double elapsed{0.0};             //!< Time since the start of the run, in seconds
+    double iterationsPerSecond{0.0}; //!< Iterations per second over all chains, since the previous sample
+    double acceptanceRate{0.0};      //!< Ratio of accepted moves to proposed ones over all chains, since the previous sample
+    double currentError{0.0};
+    double bestError{0.0};
+    double temperature{0.0};
+};
+
+/**
+ * Move used to adapt value-based neighbour functions to the in-place interface of the Annealer
+ * Applying it swaps the state with the neighbour it holds, and reverting it swaps them back.
  */
 template <class T>
+struct NeighbourMove
+{
+    T state;
+    double delta{0.0};
+};
+
+/**
+ * Annealer, a simulated-annealing optimizing class
+ * States are modified in place by moves: a move is proposed, applied to the current
+ * state, and reverted if rejected. The best state is only copied once in a while,
+ * so that no state is copied nor allocated in the steady state. The value-based
+ * interface, where neighbour functions return a new state, is adapted over it.
+ */
+template <class T, class M = NeighbourMove<T>>
 class Annealer
 {
   public:
     using ErrorFunc = std::function<double(const T&)>;
     using NeighbourFunc = std::function<T(const T&)>;
+    using DeltaNeighbourFunc = std::function<T(const T&, double&)>;
+    using ProposeFunc = std::function<M(const T&, std::mt19937&)>;
+    using ApplyFunc = std::function<double(T&, M&, double)>;
+    using RevertFunc = std::function<void(T&, M&)>;
+    using WriteFunc = std::function<void(std::ostream&, const T&)>;
+    using ReadFunc = std::function<bool(std::istream&, T&)>;
+    using ObserverFunc = std::function<void(const AnnealingStats&)>;
+    using ScoreFunc = std::function<double(const T&, const M&)>;
+    using ApplyScoredFunc = std::function<void(T&, M&)>;
+    using ConflictFunc = std::function<bool(const M&, const M&)>;
+
+    /**
+     * Cooling schedules, giving the temperature at each iteration
+     */
+    enum class Schedule
+    {
+        Linear,      //!< Decreases linearly down to zero at the last iteration
+        Exponential, //!< Decreases geometrically down to a thousandth of the initial temperature
+        Logarithmic, //!< Decreases as 1 / log(k), following Geman & Geman
+        Adaptive     //!< Adjusted to follow a target acceptance rate which decreases along the run
+    };
+
+    /**
+     * Selection of the moves to apply among a batch of candidates
+     */
+    enum class BatchMode
+    {
+        Metropolis, //!< Each candidate is accepted or not following the Metropolis criterion
+        Best        //!< Only the candidate with the lowest error variation is considered
+    };
 
   public:
     /**
@@ -40,58 +119,686 @@ class Annealer
      * \param efunc Error function
      * \param nfunc Neighbour generation function
      */
-    Annealer(size_t kMax, const ErrorFunc& eFunc, const NeighbourFunc& nfunc) : _kMax(kMax), _errorFunc(eFunc), _neighbourFunc(nfunc) {}
+    Annealer(size_t kMax, const ErrorFunc& eFunc, const NeighbourFunc& nfunc)
+        : Annealer(kMax,
+              eFunc,
+              [nfunc](const T& state, std::mt19937&) -> M { return {nfunc(state), 0.0}; },
+              [eFunc](T& state, M& move, double) -> double {
+                  std::swap(state, move.state);
+                  return eFunc(state);
+              },
+              [](T& state, M& move) { std::swap(state, move.state); })
+    {
+        static_assert(std::is_same_v<M, NeighbourMove<T>>, "Value-based neighbour functions require NeighbourMove moves");
+    }
+
+    /**
+     * Constructor, for neighbour functions able to compute the error variation incrementally
+     * The error function is then only called once on the initial state, and the current
+     * error is kept up to date by adding the deltas returned by the neighbour function.
+     * \param kMax Maximum iteration count
+     * \param efunc Error function
+     * \param nfunc Neighbour generation function, which sets its second parameter to the error variation
+     */
+    Annealer(size_t kMax, const ErrorFunc& eFunc, const DeltaNeighbourFunc& nfunc)
+        : Annealer(kMax,
+              eFunc,
+              [nfunc](const T& state, std::mt19937&) -> M {
+                  double delta = 0.0;
+                  auto neighbour = nfunc(state, delta);
+                  return {std::move(neighbour), delta};
+              },
+              [](T& state, M& move, double error) -> double {
+                  std::swap(state, move.state);
+                  return error + move.delta;
+              },
+              [](T& state, M& move) { std::swap(state, move.state); })
+    {
+        static_assert(std::is_same_v<M, NeighbourMove<T>>, "Value-based neighbour functions require NeighbourMove moves");
+    }
+
+    /**
+     * Constructor, for in-place moves
+     * \param kMax Maximum iteration count
+     * \param efunc Error function, only called on the initial state
+     * \param proposeFunc Move proposal function, drawing a move for the given state from the given generator
+     * \param applyFunc Move application function, modifying the state in place and returning its new error given the previous one
+     * \param revertFunc Move reversion function, restoring the state as it was before applying the move
+     */
+    Annealer(size_t kMax, const ErrorFunc& eFunc, const ProposeFunc& proposeFunc, const ApplyFunc& applyFunc, const RevertFunc& revertFunc)
+        : _kMax(kMax)
+        , _temperature(static_cast<double>(kMax))
+        , _errorFunc(eFunc)
+        , _proposeFunc(proposeFunc)
+        , _applyFunc(applyFunc)
+        , _revertFunc(revertFunc)
+    {
+    }
 
     /**
      * Apply simulated annealing from the given initial state
-     * \param initialState Initial state
+     * \param initialState Initial state, also used as a template to read checkpointed states into
+     * \param resume If true, continue from the checkpoint file if it can be read
      * \return Return the optimized state
      */
-    T cook(const T& initialState);
+    T cook(const T& initialState, bool resume = false);
+
+    /**
+     * Get whether the last call to cook() resumed from the checkpoint file
+     * \return Return true if it did, false if it started over or was not asked to resume
+     */
+    bool hasResumed() const { return _hasResumed; }
+
+    /**
+     * Get whether all the checkpoints of the last call to cook() were written to disk
+     * \return Return false if writing one of them failed
+     */
+    bool hasWrittenCheckpoints() const { return _hasWrittenCheckpoints; }
+
+    /**
+     * Set the cooling schedule
+     * \param schedule Cooling schedule
+     * \param temperature Initial temperature, defaults to the maximum iteration count
+     */
+    void setSchedule(Schedule schedule, double temperature)
+    {
+        _schedule = schedule;
+        _temperature = temperature;
+    }
+
+    /**
+     * Set the number of Markov chains to run in parallel, for parallel tempering
+     * Chains run at temperatures spread geometrically between the scheduled temperature and
+     * temperatureRatio times that, and neighbouring chains periodically exchange their states
+     * following the replica-exchange criterion. The move and error functions are called
+     * concurrently from multiple threads if a thread pool is set.
+     * \param count Number of chains
+     * \param exchangeInterval Number of iterations between state exchanges
+     * \param temperatureRatio Ratio between the temperatures of the hottest and coldest chains
+     */
+    void setChains(size_t count, size_t exchangeInterval = 100, double temperatureRatio = 10.0)
+    {
+        _chainCount = std::max<size_t>(count, 1);
+        _exchangeInterval = std::max<size_t>(exchangeInterval, 1);
+        _temperatureRatio = temperatureRatio;
+    }
+
+    /**
+     * Set the minimum number of iterations between two copies of the best state of a chain
+     * Improvements found in between are only kept if the chain is still at its best when
+     * the next copy is allowed. The final state of each chain is always considered.
+     * \param interval Snapshot interval, 1 to copy every improvement
+     */
+    void setSnapshotInterval(size_t interval) { _snapshotInterval = std::max<size_t>(interval, 1); }
+
+    /**
+     * Set the thread pool to run the chains on
+     * \param pool Thread pool, or nullptr to run on the calling thread
+     */
+    void setThreadPool(ThreadPool* pool) { _pool = pool; }
+
+    /**
+     * Set the seed of the random generators, for reproducible runs
+     * \param seed Seed, from which the generator of each chain is seeded
+     */
+    void setSeed(std::mt19937::result_type seed)
+    {
+        _seed = seed;
+        _isSeeded = true;
+    }
+
+    /**
+     * Propose moves by batches of non-conflicting candidates
+     * At each iteration, up to size candidates are drawn, discarding those conflicting with the
+     * ones already drawn. Their error variations are then evaluated together, in parallel if a
+     * thread pool is set, before selecting the moves to apply. Conflicting moves are those whose
+     * error variations depend on each other, so that those of the selected moves add up.
+     * \param size Number of candidates per iteration, 1 to disable batches
+     * \param mode Selection of the moves to apply among the candidates
+     * \param scoreFunc Function returning the error variation of a move, without applying it
+     * \param applyScoredFunc Function applying a move in place, its error variation being already known
+     * \param conflictFunc Function returning true if two moves conflict
+     */
+    void setBatch(size_t size, BatchMode mode, const ScoreFunc& scoreFunc, const ApplyScoredFunc& applyScoredFunc, const ConflictFunc& conflictFunc)
+    {
+        _batchSize = std::max<size_t>(size, 1);
+        _batchMode = mode;
+        _scoreFunc = scoreFunc;
+        _applyScoredFunc = applyScoredFunc;
+        _conflictFunc = conflictFunc;
+    }
+
+    /**
+     * Set a function to be called periodically with the statistics of the run
+     * It is called from the thread running cook(), between exchange rounds, and once at the end.
+     * \param observer Observer function
+     * \param interval Minimum number of iterations between two calls
+     */
+    void setObserver(const ObserverFunc& observer, size_t interval)
+    {
+        _observer = observer;
+        _observerInterval = std::max<size_t>(interval, 1);
+    }
+
+    /**
+     * Enable periodic checkpoints of the whole annealing state
+     * Checkpoints hold the states, errors, schedule positions and random generators of all
+     * chains, so that resuming from one gives the same result as an uninterrupted run.
+     * They are taken between exchange rounds, and written to disk in the background. A checkpoint
+     * is only resumed from if it was taken with the same seed, schedule, chains and batches.
+     * \param filename Path to the checkpoint file
+     * \param interval Minimum number of iterations between two checkpoints
+     * \param writeFunc State serialization function
+     * \param readFunc State deserialization function, returning false on failure
+     */
+    void setCheckpoint(const std::string& filename, size_t interval, const WriteFunc& writeFunc, const ReadFunc& readFunc)
+    {
+        _checkpointFilename = filename;
+        _checkpointInterval = std::max<size_t>(interval, 1);
+        _writeFunc = writeFunc;
+        _readFunc = readFunc;
+    }
 
   private:
+    struct Chain
+    {
+        Chain(const T& state, double error, double scale, std::mt19937::result_type seed)
+            : currentState(state)
+            , bestState(state)
+            , currentError(error)
+            , bestError(error)
+            , temperatureScale(scale)
+            , rgen(seed)
+        {
+        }
+
+        T currentState;
+        T bestState;
+        double currentError;
+        double bestError;
+        size_t lastSnapshot{0};
+        double temperatureScale;
+        double adaptiveFactor{1.0};
+        size_t accepted{0};      //!< Accepted moves in the current adaptive window
+        size_t proposed{0};      //!< Proposed moves in the current adaptive window
+        size_t totalAccepted{0}; //!< Accepted moves since the start, for statistics
+        size_t totalProposed{0}; //!< Proposed moves since the start, for statistics
+        size_t iterations{0};    //!< Iterations done since the start, for statistics
+        std::mt19937 rgen;
+        std::vector<M> candidates{};  //!< Candidate moves of the current batch, kept to avoid allocations
+        std::vector<double> deltas{}; //!< Error variations of the candidate moves
+    };
+
+    static constexpr size_t _adaptiveWindow{100};
+    static constexpr double _adaptiveTargetRate{0.44};
+    static constexpr double _exponentialFinalRatio{1e-3};
+    static constexpr char _checkpointMagic[8]{'B', 'N', 'C', 'K', 'P', 'T', '0', '3'};
+    static constexpr size_t _maxGeneratorStateSize{1 << 16};
+    static constexpr size_t _batchDrawFactor{4};
+
     size_t _kMax{1000};
     double _eMax{1e-3};
+    Schedule _schedule{Schedule::Linear};
+    double _temperature{1000.0};
+    size_t _chainCount{1};
+    size_t _exchangeInterval{100};
+    double _temperatureRatio{10.0};
+    size_t _snapshotInterval{1000};
+    ThreadPool* _pool{nullptr};
+    bool _isSeeded{false};
+    std::mt19937::result_type _seed{0};
     ErrorFunc _errorFunc{};
-    NeighbourFunc _neighbourFunc{};
+    ProposeFunc _proposeFunc{};
+    ApplyFunc _applyFunc{};
+    size_t _batchSize{1};
+    BatchMode _batchMode{BatchMode::Metropolis};
+    ScoreFunc _scoreFunc{};
+    ApplyScoredFunc _applyScoredFunc{};
+    ConflictFunc _conflictFunc{};
+    RevertFunc _revertFunc{};
+    std::string _checkpointFilename{};
+    size_t _checkpointInterval{0};
+    WriteFunc _writeFunc{};
+    ReadFunc _readFunc{};
+    ObserverFunc _observer{};
+    size_t _observerInterval{0};
+    bool _hasResumed{false};
+    bool _hasWrittenCheckpoints{true};
+
+    /**
+     * Progress of a run, at the start of a round
+     */
+    struct Progress
+    {
+        size_t iteration{0};
+        size_t round{0};
+    };
 
-    double iterToTemp(size_t iter) const { return static_cast<double>(_kMax - iter); }
+    double iterToTemp(const Chain& chain, size_t iter) const;
+    void step(Chain& chain, size_t iter) const;
+    void stepBatch(Chain& chain, size_t iter) const;
+    void endStep(Chain& chain, size_t iter) const;
+    bool isAccepted(Chain& chain, size_t iter, double delta) const;
+    void snapshot(Chain& chain, size_t iter) const;
+    void exchange(std::vector<Chain>& chains, std::vector<size_t>& ladder, size_t first, size_t iter, std::mt19937& rgen) const;
+    std::string writeCheckpoint(const std::vector<Chain>& chains, const std::vector<size_t>& ladder, const Progress& progress, const std::mt19937& rgen) const;
+    bool readCheckpoint(const T& initialState, std::vector<Chain>& chains, std::vector<size_t>& ladder, Progress& progress, std::mt19937& rgen) const;
 };
 
 /*************/
-template <class T>
-T Annealer<T>::cook(const T& initialState)
+template <class T, class M>
+T Annealer<T, M>::cook(const T& initialState, bool resume)
 {
-    auto currentState = initialState;
-    auto bestState = initialState;
+    std::random_device rdevice;
+    std::mt19937 rgen(_isSeeded ? _seed : rdevice());
 
-    auto currentError = _errorFunc(currentState);
-    auto bestError = _errorFunc(bestState);
+    // The ladder holds the index of the chain running at each temperature, from the coldest
+    std::vector<Chain> chains;
+    std::vector<size_t> ladder;
+    Progress progress;
+    const bool checkpoint = !_checkpointFilename.empty();
+    _hasResumed = resume && checkpoint && readCheckpoint(initialState, chains, ladder, progress, rgen);
+    if (!_hasResumed)
+    {
+        const auto initialError = _errorFunc(initialState);
+        chains.clear();
+        ladder.clear();
+        progress = Progress();
+        chains.reserve(_chainCount);
+        for (size_t c = 0; c < _chainCount; ++c)
+        {
+            const auto scale = _chainCount == 1 ? 1.0 : std::pow(_temperatureRatio, static_cast<double>(c) / static_cast<double>(_chainCount - 1));
+            chains.emplace_back(initialState, initialError, scale, rgen());
+            ladder.push_back(c);
+        }
+    }
 
-    std::random_device rdevice;
-    std::mt19937 rgen(rdevice());
-    std::uniform_real_distribution<float> rdist(0.f, 1.f);
+    auto bestError = std::numeric_limits<double>::max();
+    for (const auto& chain : chains)
+        bestError = std::min(bestError, chain.bestError);
+
+    // The writer thread is only started if checkpoints are enabled
+    std::optional<AsyncWriter> writer;
+    if (checkpoint)
+        writer.emplace();
+    auto lastCheckpoint = progress.iteration;
+    auto lastSample = progress.iteration;
+    const auto startTime = std::chrono::steady_clock::now();
+    auto sampleTime = startTime;
+    size_t sampleIterations = 0;
+    size_t sampleProposed = 0;
+    size_t sampleAccepted = 0;
+    const auto sample = [&]() {
+        const auto now = std::chrono::steady_clock::now();
+        size_t iterations = 0;
+        size_t proposed = 0;
+        size_t accepted = 0;
+        for (const auto& chain : chains)
+        {
+            iterations += chain.iterations;
+            proposed += chain.totalProposed;
+            accepted += chain.totalAccepted;
+        }
+
+        const auto& coldest = chains[ladder[0]];
+        AnnealingStats stats;
+        stats.iteration = progress.iteration;
+        stats.iterationCount = _kMax;
+        stats.elapsed = std::chrono::duration<double>(now - startTime).count();
+        const auto interval = std::chrono::duration<double>(now - sampleTime).count();
+        stats.iterationsPerSecond = interval > 0.0 ? static_cast<double>(iterations - sampleIterations) / interval : 0.0;
+        stats.acceptanceRate = proposed > sampleProposed ? static_cast<double>(accepted - sampleAccepted) / static_cast<double>(proposed - sampleProposed) : 0.0;
+        stats.currentError = coldest.currentError;
+        stats.bestError = bestError;
+        stats.temperature = iterToTemp(coldest, std::min(progress.iteration, _kMax - 1));
+        _observer(stats);
 
-    for (size_t k = 0; k < _kMax && currentError > _eMax; ++k)
+        sampleTime = now;
+        sampleIterations = iterations;
+        sampleProposed = proposed;
+        sampleAccepted = accepted;
+        lastSample = progress.iteration;
+    };
+
+    while (progress.iteration < _kMax && bestError > _eMax)
     {
-        auto newState = _neighbourFunc(currentState);
-        auto newError = _errorFunc(newState);
+        const auto k = progress.iteration;
+        const auto roundEnd = std::min(k + _exchangeInterval, _kMax);
+        const auto runChain = [&](size_t c) {
+            auto& chain = chains[c];
+            for (size_t iter = k; iter < roundEnd && chain.currentError > _eMax; ++iter, ++chain.iterations)
+            {
+                if (_batchSize > 1)
+                    stepBatch(chain, iter);
+                else
+                    step(chain, iter);
+            }
+            if (chain.currentError < chain.bestError)
+                snapshot(chain, roundEnd);
+        };
+
+        if (_pool)
+            _pool->run(chains.size(), runChain);
+        else
+            for (size_t c = 0; c < chains.size(); ++c)
+                runChain(c);
+
+        exchange(chains, ladder, progress.round % 2, roundEnd - 1, rgen);
+
+        for (const auto& chain : chains)
+            bestError = std::min(bestError, chain.bestError);
+
+        progress.iteration = roundEnd;
+        ++progress.round;
+
+        if (_observer && progress.iteration >= lastSample + _observerInterval && progress.iteration < _kMax)
+            sample();
 
-        std::cout << "Current best error: " << bestError << " " << std::exp((currentError - newError) / iterToTemp(k)) << "\n";
-        if (newError < currentError || rdist(rgen) < std::exp((currentError - newError) / iterToTemp(k)))
+        // The state is serialized here, only the disk access is deferred
+        if (checkpoint && (progress.iteration >= lastCheckpoint + _checkpointInterval || progress.iteration >= _kMax || bestError <= _eMax))
         {
-            currentState = newState;
-            currentError = newError;
+            writer->write(_checkpointFilename, writeCheckpoint(chains, ladder, progress, rgen));
+            lastCheckpoint = progress.iteration;
         }
+    }
+
+    if (_observer)
+        sample();
+
+    _hasWrittenCheckpoints = !checkpoint || writer->flush();
+
+    const auto bestChain = std::min_element(chains.begin(), chains.end(), [](const Chain& a, const Chain& b) { return a.bestError < b.bestError; });
+    return bestChain->bestState;
+}
+
+/*************/
+template <class T, class M>
+double Annealer<T, M>::iterToTemp(const Chain& chain, size_t iter) const
+{
+    const auto progress = static_cast<double>(iter) / static_cast<double>(_kMax);
+    double temperature = _temperature;
+    switch (_schedule)
+    {
+    case Schedule::Linear:
+        temperature *= 1.0 - progress;
+        break;
+    case Schedule::Exponential:
+        temperature *= std::pow(_exponentialFinalRatio, progress);
+        break;
+    case Schedule::Logarithmic:
+        temperature *= std::log(2.0) / std::log(static_cast<double>(iter) + 2.0);
+        break;
+    case Schedule::Adaptive:
+        temperature *= chain.adaptiveFactor;
+        break;
+    }
+
+    return temperature * chain.temperatureScale;
+}
+
+/*************/
+template <class T, class M>
+void Annealer<T, M>::step(Chain& chain, size_t iter) const
+{
+    auto move = _proposeFunc(chain.currentState, chain.rgen);
+    const auto newError = _applyFunc(chain.currentState, move, chain.currentError);
+    ++chain.proposed;
+    ++chain.totalProposed;
+
+    if (isAccepted(chain, iter, newError - chain.currentError))
+        chain.currentError = newError;
+    else
+        _revertFunc(chain.currentState, move);
+
+    endStep(chain, iter);
+}
+
+/*************/
+template <class T, class M>
+void Annealer<T, M>::stepBatch(Chain& chain, size_t iter) const
+{
+    // Draw non-conflicting candidates, giving up after a few attempts on small states
+    auto& moves = chain.candidates;
+    moves.clear();
+    moves.reserve(_batchSize);
+    for (size_t draw = 0; draw < _batchSize * _batchDrawFactor && moves.size() < _batchSize; ++draw)
+    {
+        auto move = _proposeFunc(chain.currentState, chain.rgen);
+        if (std::none_of(moves.begin(), moves.end(), [&](const M& other) { return _conflictFunc(move, other); }))
+            moves.push_back(std::move(move));
+    }
+
+    // In Best mode a single move is put to the acceptance test, so that the acceptance rate
+    // is comparable to unbatched runs, and the adaptive schedule can reach its target
+    const auto proposed = _batchMode == BatchMode::Best ? 1 : moves.size();
+    chain.proposed += proposed;
+    chain.totalProposed += proposed;
+
+    auto& deltas = chain.deltas;
+    deltas.resize(moves.size());
+    const auto score = [&](size_t index) { deltas[index] = _scoreFunc(chain.currentState, moves[index]); };
+    if (_pool)
+        _pool->run(moves.size(), score);
+    else
+        for (size_t index = 0; index < moves.size(); ++index)
+            score(index);
+
+    if (_batchMode == BatchMode::Best)
+    {
+        const auto best = std::min_element(deltas.begin(), deltas.end()) - deltas.begin();
+        if (isAccepted(chain, iter, deltas[best]))
+        {
+            _applyScoredFunc(chain.currentState, moves[best]);
+            chain.currentError += deltas[best];
+        }
+    }
+    else
+    {
+        // As the moves do not conflict, the variations computed from the current state still
+        // hold once other moves of the batch have been applied
+        for (size_t index = 0; index < moves.size(); ++index)
+        {
+            if (isAccepted(chain, iter, deltas[index]))
+            {
+                _applyScoredFunc(chain.currentState, moves[index]);
+                chain.currentError += deltas[index];
+            }
+        }
+    }
+
+    endStep(chain, iter);
+}
+
+/*************/
+template <class T, class M>
+bool Annealer<T, M>::isAccepted(Chain& chain, size_t iter, double delta) const
+{
+    std::uniform_real_distribution<float> rdist(0.f, 1.f);
+    if (delta < 0.0 || rdist(chain.rgen) < std::exp(-delta / iterToTemp(chain, iter)))
+    {
+        ++chain.accepted;
+        ++chain.totalAccepted;
+        return true;
+    }
+    return false;
+}
+
+/*************/
+template <class T, class M>
+void Annealer<T, M>::endStep(Chain& chain, size_t iter) const
+{
+    if (chain.currentError < chain.bestError && iter >= chain.lastSnapshot + _snapshotInterval)
+        snapshot(chain, iter);
+
+    // Steer the temperature so that the acceptance rate follows a target which decreases
+    // linearly along the run, updated once every window of iterations
+    if (_schedule == Schedule::Adaptive && (iter + 1) % _adaptiveWindow == 0)
+    {
+        const auto rate = chain.proposed ? static_cast<double>(chain.accepted) / static_cast<double>(chain.proposed) : 0.0;
+        const auto target = _adaptiveTargetRate * (1.0 - static_cast<double>(iter) / static_cast<double>(_kMax));
+        chain.adaptiveFactor *= std::exp(target - rate);
+        chain.accepted = 0;
+        chain.proposed = 0;
+    }
+}
+
+/*************/
+template <class T, class M>
+void Annealer<T, M>::snapshot(Chain& chain, size_t iter) const
+{
+    chain.bestState = chain.currentState;
+    chain.bestError = chain.currentError;
+    chain.lastSnapshot = iter;
+}
+
+/*************/
+template <class T, class M>
+void Annealer<T, M>::exchange(std::vector<Chain>& chains, std::vector<size_t>& ladder, size_t first, size_t iter, std::mt19937& rgen) const
+{
+    std::uniform_real_distribution<double> rdist(0.0, 1.0);
 
-        if (currentError < bestError)
+    // Rounds alternate between even and odd pairs of neighbouring temperatures. Exchanging
+    // the temperatures of the two chains is equivalent to exchanging their states, without copies
+    for (size_t c = first; c + 1 < ladder.size(); c += 2)
+    {
+        auto& cold = chains[ladder[c]];
+        auto& hot = chains[ladder[c + 1]];
+        const auto coldTemp = std::max(iterToTemp(cold, iter), std::numeric_limits<double>::min());
+        const auto hotTemp = std::max(iterToTemp(hot, iter), std::numeric_limits<double>::min());
+        const auto criterion = (cold.currentError - hot.currentError) * (1.0 / coldTemp - 1.0 / hotTemp);
+        if (criterion >= 0.0 || rdist(rgen) < std::exp(criterion))
         {
-            bestState = currentState;
-            bestError = currentError;
+            std::swap(cold.temperatureScale, hot.temperatureScale);
+            std::swap(cold.adaptiveFactor, hot.adaptiveFactor);
+            std::swap(ladder[c], ladder[c + 1]);
         }
     }
+}
+
+/*************/
+template <class T, class M>
+std::string Annealer<T, M>::writeCheckpoint(const std::vector<Chain>& chains, const std::vector<size_t>& ladder, const Progress& progress, const std::mt19937& rgen) const
+{
+    // Floating point values are written bit for bit, and generators through their textual state
+    std::ostringstream stream(std::ios::binary);
+    const auto writeValue = [&](auto value) { stream.write(reinterpret_cast<const char*>(&value), sizeof(value)); };
+    const auto writeGenerator = [&](const std::mt19937& generator) {
+        std::ostringstream state;
+        state << generator;
+        writeValue(static_cast<uint64_t>(state.str().size()));
+        stream << state.str();
+    };
+
+    stream.write(_checkpointMagic, sizeof(_checkpointMagic));
+    writeValue(static_cast<uint64_t>(_kMax));
+    writeValue(static_cast<uint64_t>(_exchangeInterval));
+    writeValue(static_cast<uint64_t>(chains.size()));
+    writeValue(static_cast<uint64_t>(_isSeeded));
+    writeValue(static_cast<uint64_t>(_isSeeded ? _seed : 0));
+    writeValue(static_cast<uint64_t>(_schedule));
+    writeValue(_temperature);
+    writeValue(_temperatureRatio);
+    writeValue(static_cast<uint64_t>(_batchSize));
+    writeValue(static_cast<uint64_t>(_batchMode));
+    writeValue(static_cast<uint64_t>(progress.iteration));
+    writeValue(static_cast<uint64_t>(progress.round));
+    writeGenerator(rgen);
+    for (const auto index : ladder)
+        writeValue(static_cast<uint64_t>(index));
+
+    for (const auto& chain : chains)
+    {
+        writeValue(chain.currentError);
+        writeValue(chain.bestError);
+        writeValue(static_cast<uint64_t>(chain.lastSnapshot));
+        writeValue(chain.temperatureScale);
+        writeValue(chain.adaptiveFactor);
+        writeValue(static_cast<uint64_t>(chain.accepted));
+        writeValue(static_cast<uint64_t>(chain.proposed));
+        writeGenerator(chain.rgen);
+        _writeFunc(stream, chain.currentState);
+        _writeFunc(stream, chain.bestState);
+    }
+
+    return stream.str();
+}
+
+/*************/
+template <class T, class M>
+bool Annealer<T, M>::readCheckpoint(const T& initialState, std::vector<Chain>& chains, std::vector<size_t>& ladder, Progress& progress, std::mt19937& rgen) const
+{
+    std::ifstream stream(_checkpointFilename, std::ios::binary);
+    if (!stream.is_open())
+        return false;
+
+    const auto readValue = [&](auto& value) { return static_cast<bool>(stream.read(reinterpret_cast<char*>(&value), sizeof(value))); };
+    const auto readSize = [&](size_t& value) {
+        uint64_t size;
+        if (!readValue(size))
+            return false;
+        value = size;
+        return true;
+    };
+    const auto readGenerator = [&](std::mt19937& generator) {
+        size_t size;
+        if (!readSize(size) || size > _maxGeneratorStateSize)
+            return false;
+        std::string state(size, '\0');
+        if (!stream.read(state.data(), size))
+            return false;
+        std::istringstream stateStream(state);
+        stateStream >> generator;
+        return !stateStream.fail();
+    };
+
+    char magic[sizeof(_checkpointMagic)];
+    if (!stream.read(magic, sizeof(magic)) || !std::equal(magic, magic + sizeof(magic), _checkpointMagic))
+        return false;
+
+    // The run parameters must match for the remaining iterations to be the same
+    size_t kMax, exchangeInterval, chainCount;
+    if (!readSize(kMax) || !readSize(exchangeInterval) || !readSize(chainCount))
+        return false;
+    if (kMax != _kMax || exchangeInterval != _exchangeInterval || chainCount != _chainCount)
+        return false;
+
+    // So must the seed, if any, as it identifies the run, and the temperatures
+    size_t isSeeded, seed, schedule, batchSize, batchMode;
+    double temperature, temperatureRatio;
+    if (!readSize(isSeeded) || !readSize(seed) || !readSize(schedule) || !readValue(temperature) || !readValue(temperatureRatio) || !readSize(batchSize) || !readSize(batchMode))
+        return false;
+    if (static_cast<bool>(isSeeded) != _isSeeded || (_isSeeded && seed != _seed) || schedule != static_cast<size_t>(_schedule))
+        return false;
+    if (temperature != _temperature || temperatureRatio != _temperatureRatio || batchSize != _batchSize || batchMode != static_cast<size_t>(_batchMode))
+        return false;
+
+    if (!readSize(progress.iteration) || !readSize(progress.round) || !readGenerator(rgen))
+        return false;
+
+    // The ladder must be a permutation of the chains, each of them running at one temperature
+    ladder.resize(chainCount);
+    std::vector<bool> isOnLadder(chainCount, false);
+    for (auto& index : ladder)
+    {
+        if (!readSize(index) || index >= chainCount || isOnLadder[index])
+            return false;
+        isOnLadder[index] = true;
+    }
+
+    chains.clear();
+    chains.reserve(chainCount);
+    for (size_t c = 0; c < chainCount; ++c)
+    {
+        auto& chain = chains.emplace_back(initialState, 0.0, 1.0, 0);
+        if (!readValue(chain.currentError) || !readValue(chain.bestError) || !readSize(chain.lastSnapshot))
+            return false;
+        if (!readValue(chain.temperatureScale) || !readValue(chain.adaptiveFactor) || !readSize(chain.accepted) || !readSize(chain.proposed))
+            return false;
+        if (!readGenerator(chain.rgen) || !_readFunc(stream, chain.currentState) || !_readFunc(stream, chain.bestState))
+            return false;
+    }
 
-    return bestState;
+    return true;
 }
 
 } // namespace bluenoise
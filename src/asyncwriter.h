@@ -0,0 +1,140 @@
+/*
+ * Copyright (C) 2019 Emmanuel Durand
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Splash is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+
+namespace bluenoise
+{
+
+/**
+ * Background file writer
+ * Data is handed over to a dedicated thread, so that the caller never waits for the disk.
+ * Files are written to a temporary path then renamed, so that a crash during a write leaves
+ * the previous version of the file untouched. If a file is written again before its previous
+ * content reached the disk, only the latest content is written.
+ */
+class AsyncWriter
+{
+  public:
+    /**
+     * Constructor
+     */
+    AsyncWriter()
+        : _thread([this]() { work(); })
+    {
+    }
+
+    /**
+     * Destructor, waiting for all pending writes
+     */
+    ~AsyncWriter()
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stop = true;
+        }
+        _wakeCondition.notify_one();
+        _thread.join();
+    }
+
+    AsyncWriter(const AsyncWriter&) = delete;
+    AsyncWriter& operator=(const AsyncWriter&) = delete;
+
+    /**
+     * Queue data to be written to a file
+     * \param filename Path to the file
+     * \param data Data to write, replacing the current content of the file
+     */
+    void write(const std::string& filename, std::string data)
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _pending[filename] = std::move(data);
+        }
+        _wakeCondition.notify_one();
+    }
+
+    /**
+     * Wait for all pending writes to be done
+     * \return Return true if all writes since the last call succeeded
+     */
+    bool flush()
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _doneCondition.wait(lock, [&]() { return _pending.empty() && !_isWriting; });
+        return !std::exchange(_hasFailed, false);
+    }
+
+  private:
+    std::mutex _mutex{};
+    std::condition_variable _wakeCondition{};
+    std::condition_variable _doneCondition{};
+    std::map<std::string, std::string> _pending{};
+    bool _isWriting{false};
+    bool _hasFailed{false};
+    bool _stop{false};
+    std::thread _thread;
+
+    void work()
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        while (true)
+        {
+            _wakeCondition.wait(lock, [&]() { return _stop || !_pending.empty(); });
+            if (_pending.empty())
+                return;
+
+            auto node = _pending.extract(_pending.begin());
+            _isWriting = true;
+            lock.unlock();
+
+            const auto success = writeFile(node.key(), node.mapped());
+
+            lock.lock();
+            _isWriting = false;
+            _hasFailed = _hasFailed || !success;
+            if (_pending.empty())
+                _doneCondition.notify_all();
+        }
+    }
+
+    static bool writeFile(const std::string& filename, const std::string& data)
+    {
+        const auto tmpFilename = filename + ".tmp";
+        {
+            std::ofstream file(tmpFilename, std::ios::binary | std::ios::trunc);
+            if (!file.is_open())
+                return false;
+            file.write(data.data(), data.size());
+            if (!file.good())
+                return false;
+        }
+        return std::rename(tmpFilename.c_str(), filename.c_str()) == 0;
+    }
+};
+
+} // namespace bluenoise
@@ -0,0 +1,449 @@
+/*
+ * Copyright (C) 2019 Emmanuel Durand
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Splash is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <getopt.h>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "./annealer.h"
+#include "./parse.h"
+#include "./pattern.h"
+#include "./runtime.h"
+#include "./voidcluster.h"
+
+using namespace bluenoise;
+
+using Pat = DynamicPattern;
+using Ann = Annealer<Pat, Pat::Swap>;
+
+/**
+ * Result of a single benchmark
+ */
+struct Measure
+{
+    std::string kernel{};
+    size_t size{0};
+    size_t dims{0};
+    double value{0.0};
+    std::string unit{};
+
+    bool isThroughput() const { return unit == "it/s"; }
+};
+
+/*************/
+void printUsage(const char* name)
+{
+    std::cout << "Usage: " << name << " [options]\n"
+              << "Options:\n"
+              << "  -s, --sizes LIST        Comma-separated pattern sizes to benchmark (default: 16,32,64,128,256)\n"
+              << "  -d, --dims LIST         Comma-separated channel counts to benchmark (default: 1,2,3,4)\n"
+              << "  -m, --min-time T        Minimum time spent on each benchmark, in seconds (default: 0.2)\n"
+              << "  -b, --baseline FILE     Compare the results to a baseline, and fail on regressions\n"
+              << "  -w, --write-baseline F  Write the results as a baseline\n"
+              << "  -r, --tolerance R       Relative slowdown tolerated when comparing to the baseline (default: 0.25)\n"
+              << "  -q, --quality           Only run the noise quality check\n"
+              << "  -h, --help              Show this help\n";
+}
+
+/*************/
+bool parseList(const std::string& list, std::vector<size_t>& values)
+{
+    values.clear();
+    std::stringstream stream(list);
+    std::string item;
+    while (std::getline(stream, item, ','))
+    {
+        size_t value;
+        if (!parseSize(item, value) || value == 0)
+            return false;
+        values.push_back(value);
+    }
+    return !values.empty();
+}
+
+/*************/
+template <class F>
+double getTimePerCall(const F& func, double minTime)
+{
+    using Clock = std::chrono::steady_clock;
+    size_t calls = 0;
+    const auto start = Clock::now();
+    double elapsed = 0.0;
+    do
+    {
+        func();
+        ++calls;
+        elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+    } while (elapsed < minTime);
+    return elapsed / static_cast<double>(calls);
+}
+
+/*************/
+volatile double resultSink{0.0};
+
+/*************/
+void keepResult(double value)
+{
+    // Keeps the compiler from optimizing out computations whose result is unused
+    resultSink = value;
+}
+
+/*************/
+Ann makeAnnealer(size_t iterations, const EnergyKernel& kernel, const Ann::ErrorFunc& errorFunc)
+{
+    Ann::ProposeFunc proposeFunc = [](const Pat& pattern, std::mt19937& rgen) -> Pat::Swap
+    {
+        std::uniform_int_distribution<size_t> xdist(0, pattern.getWidth() - 1);
+        std::uniform_int_distribution<size_t> ydist(0, pattern.getHeight() - 1);
+        Pat::Swap move;
+        move.xi = xdist(rgen);
+        move.xj = xdist(rgen);
+        move.yi = ydist(rgen);
+        move.yj = ydist(rgen);
+        return move;
+    };
+    Ann::ApplyFunc applyFunc = [&kernel](Pat& pattern, Pat::Swap& move, double error) -> double
+    {
+        const auto delta = pattern.getSwapEnergyDelta(move, kernel);
+        pattern.swap(move);
+        return error + delta;
+    };
+    Ann::RevertFunc revertFunc = [](Pat& pattern, Pat::Swap& move) { pattern.swap(move); };
+
+    Ann annealer(iterations, errorFunc, proposeFunc, applyFunc, revertFunc);
+    annealer.setSchedule(Ann::Schedule::Exponential, 1.0);
+    annealer.setSeed(1);
+    return annealer;
+}
+
+/*************/
+std::vector<Measure> runBenchmarks(const std::vector<size_t>& sizes, const std::vector<size_t>& dimsList, double minTime)
+{
+    const EnergyKernel kernel;
+    std::vector<Measure> measures;
+    const auto report = [&](const Measure& measure) {
+        std::cout << std::left << std::setw(10) << measure.kernel << std::right << std::setw(5) << measure.size << "x" << std::left << std::setw(5) << measure.size << " dims "
+                  << measure.dims << std::right << std::setw(14) << std::setprecision(4) << measure.value << " " << measure.unit << std::endl;
+        measures.push_back(measure);
+    };
+
+    for (const auto size : sizes)
+    {
+        for (const auto dims : dimsList)
+        {
+            Pat pattern(size, size, dims, 1, 1);
+            const auto side = static_cast<double>(static_cast<int>(kernel.getRadius(size)) - kernel.getFirstOffset(size, kernel.getRadius(size)) + 1);
+            const auto window = side * side;
+            const auto pixels = static_cast<double>(size * size);
+
+            // Full energy, on the calling thread only
+            const auto energyTime = getTimePerCall([&]() { keepResult(pattern.getEnergy(kernel)); }, minTime);
+            report({"energy", size, dims, energyTime * 1e9 / (pixels * window), "ns/pair"});
+
+            // Swap energy deltas, between random pixels drawn beforehand
+            std::mt19937 rgen(1);
+            std::uniform_int_distribution<size_t> dist(0, size - 1);
+            std::vector<Pat::Swap> moves(1024);
+            for (auto& move : moves)
+                move = {dist(rgen), dist(rgen), dist(rgen), dist(rgen), 0};
+            const auto deltaTime = getTimePerCall(
+                [&]() {
+                    double sum = 0.0;
+                    for (const auto& move : moves)
+                        sum += pattern.getSwapEnergyDelta(move, kernel);
+                    keepResult(sum);
+                },
+                minTime);
+            report({"delta", size, dims, deltaTime * 1e9 / (static_cast<double>(moves.size()) * 2.0 * window), "ns/pair"});
+
+            // Annealing iterations. Only deltas drive the run, so the initial energy is not
+            // computed, to keep it out of the measure
+            const size_t iterations = 20000;
+            auto annealer = makeAnnealer(iterations, kernel, [](const Pat&) { return 1e6; });
+            const auto cookTime = getTimePerCall([&]() { keepResult(annealer.cook(pattern).data()[0]); }, minTime);
+            report({"anneal", size, dims, static_cast<double>(iterations) / cookTime, "it/s"});
+
+            // Spectrum, as computed by saveFourier and saveSpectrum
+            const auto spectrumTime = getTimePerCall([&]() { keepResult(pattern.getSpectrum().radialPower[0]); }, minTime);
+            report({"spectrum", size, dims, spectrumTime * 1e9 / pixels, "ns/pixel"});
+
+            // Runtime lookups, dithering scanlines of twice the pattern width so that they wrap
+            const NoiseTexture texture(pattern);
+            std::vector<float> values(2 * size, 0.5f);
+            std::vector<uint8_t> output(values.size());
+            const auto ditherTime = getTimePerCall(
+                [&]() {
+                    size_t sum = 0;
+                    for (size_t y = 0; y < size; ++y)
+                        for (size_t c = 0; c < dims; ++c)
+                        {
+                            texture.dither(values.data(), static_cast<int64_t>(y) - 3, y, c, 0, values.size(), output.data());
+                            sum += output[y];
+                        }
+                    keepResult(static_cast<double>(sum));
+                },
+                minTime);
+            report({"dither", size, dims, ditherTime * 1e9 / (pixels * 2.0 * static_cast<double>(dims)), "ns/pixel"});
+        }
+    }
+
+    return measures;
+}
+
+/*************/
+bool writeBaseline(const std::string& filename, const std::vector<Measure>& measures)
+{
+    std::ofstream file(filename);
+    if (!file.is_open())
+        return false;
+
+    file << "kernel,size,dims,value,unit\n" << std::setprecision(10);
+    for (const auto& measure : measures)
+        file << measure.kernel << "," << measure.size << "," << measure.dims << "," << measure.value << "," << measure.unit << "\n";
+    return file.good();
+}
+
+/*************/
+bool readBaseline(const std::string& filename, std::vector<Measure>& measures)
+{
+    std::ifstream file(filename);
+    if (!file.is_open())
+        return false;
+
+    std::string line;
+    std::getline(file, line);
+    while (std::getline(file, line))
+    {
+        std::stringstream stream(line);
+        Measure measure;
+        std::string size, dims, value;
+        if (!std::getline(stream, measure.kernel, ',') || !std::getline(stream, size, ',') || !std::getline(stream, dims, ',') || !std::getline(stream, value, ',')
+            || !std::getline(stream, measure.unit))
+            return false;
+        if (!parseSize(size, measure.size) || !parseSize(dims, measure.dims) || !parseValue(value, measure.value))
+            return false;
+        measures.push_back(measure);
+    }
+    return true;
+}
+
+/*************/
+bool compareToBaseline(const std::vector<Measure>& measures, const std::vector<Measure>& baseline, double tolerance)
+{
+    bool success = true;
+    std::cout << "\nComparison to baseline (slowdown, > 1 is slower):\n";
+    for (const auto& measure : measures)
+    {
+        const auto reference = std::find_if(baseline.begin(), baseline.end(), [&](const Measure& other) {
+            return other.kernel == measure.kernel && other.size == measure.size && other.dims == measure.dims && other.unit == measure.unit;
+        });
+        if (reference == baseline.end() || reference->value <= 0.0 || measure.value <= 0.0)
+            continue;
+
+        const auto slowdown = measure.isThroughput() ? reference->value / measure.value : measure.value / reference->value;
+        const bool isRegression = slowdown > 1.0 + tolerance;
+        success = success && !isRegression;
+        std::cout << std::left << std::setw(10) << measure.kernel << std::right << std::setw(5) << measure.size << "x" << std::left << std::setw(5) << measure.size << " dims "
+                  << measure.dims << std::right << std::setw(10) << std::setprecision(3) << slowdown << (isRegression ? "  REGRESSION" : "") << "\n";
+    }
+    return success;
+}
+
+/*************/
+bool checkSpectrum(const std::string& name, const Pat& pattern, bool isBlueNoise = true)
+{
+    // Blue noise has almost no power at low frequencies, which is pushed to high frequencies.
+    // Powers are relative to the mean power, white noise being close to 1 everywhere
+    const double maxLowPower = 0.1;
+    const double minHighPower = 1.2;
+
+    const auto spectrum = pattern.getSpectrum();
+    double meanPower = 0.0, lowPower = 0.0, highPower = 0.0;
+    size_t lowCount = 0, highCount = 0;
+    for (size_t bin = 1; bin < spectrum.frequencies.size(); ++bin)
+    {
+        const auto frequency = spectrum.frequencies[bin];
+        const auto power = spectrum.radialPower[bin];
+        meanPower += power;
+        if (frequency <= 0.125)
+        {
+            lowPower += power;
+            ++lowCount;
+        }
+        else if (frequency >= 0.35)
+        {
+            highPower += power;
+            ++highCount;
+        }
+    }
+    meanPower /= static_cast<double>(spectrum.frequencies.size() - 1);
+    lowPower /= static_cast<double>(lowCount) * meanPower;
+    highPower /= static_cast<double>(highCount) * meanPower;
+
+    const bool success = (lowPower <= maxLowPower && highPower >= minHighPower) == isBlueNoise;
+    std::cout << std::left << std::setw(30) << name << std::right << " low frequency power " << std::setprecision(3) << lowPower << " (max " << maxLowPower << ")"
+              << ", high frequency power " << highPower << " (min " << minHighPower << ")" << (success ? "" : "  FAILED") << "\n";
+    return success;
+}
+
+/*************/
+bool runQualityCheck()
+{
+    std::cout << "Noise quality check:\n";
+    bool success = true;
+
+    const EnergyKernel kernel;
+    for (const size_t dims : {1, 2})
+    {
+        const Pat initialPattern(32, 32, dims, 1, 1);
+        auto annealer = makeAnnealer(200000, kernel, [&kernel](const Pat& pattern) { return pattern.getEnergy(kernel); });
+        success = checkSpectrum("anneal 32x32 dims " + std::to_string(dims), annealer.cook(initialPattern)) && success;
+    }
+
+    // Batches in Best mode, under the adaptive schedule which relies on the acceptance rate
+    {
+        const Pat initialPattern(32, 32, 1, 1, 1);
+        auto annealer = makeAnnealer(100000, kernel, [&kernel](const Pat& pattern) { return pattern.getEnergy(kernel); });
+        annealer.setSchedule(Ann::Schedule::Adaptive, 1.0);
+        annealer.setBatch(
+            8,
+            Ann::BatchMode::Best,
+            [&kernel](const Pat& pattern, const Pat::Swap& move) { return pattern.getSwapEnergyDelta(move, kernel); },
+            [](Pat& pattern, Pat::Swap& move) { pattern.swap(move); },
+            [&](const Pat::Swap& first, const Pat::Swap& second) { return initialPattern.doSwapsInteract(first, second, kernel); });
+        // The adaptive temperature must not run away, which the spectrum alone does not show
+        // as the best candidate is still selected at any temperature
+        double maxTemperature = 0.0;
+        annealer.setObserver([&](const AnnealingStats& stats) { maxTemperature = std::max(maxTemperature, stats.temperature); }, 1000);
+        success = checkSpectrum("anneal 32x32 best of 8", annealer.cook(initialPattern)) && success;
+
+        const bool isBounded = maxTemperature <= 1.0;
+        std::cout << std::left << std::setw(30) << "anneal 32x32 best of 8" << std::right << " max temperature " << std::setprecision(3) << maxTemperature << " (max 1)"
+                  << (isBounded ? "" : "  FAILED") << "\n";
+        success = isBounded && success;
+    }
+
+    std::mt19937 rgen(1);
+    success = checkSpectrum("void-and-cluster 64x64", VoidAndCluster(64, 64, kernel).generate(rgen)) && success;
+
+    // White noise must not pass, otherwise the check is meaningless
+    success = checkSpectrum("white noise 64x64 (reference)", Pat(64, 64, 1, 1, 1), false) && success;
+
+    return success;
+}
+
+/*************/
+int main(int argc, char** argv)
+{
+    std::vector<size_t> sizes{16, 32, 64, 128, 256};
+    std::vector<size_t> dimsList{1, 2, 3, 4};
+    double minTime = 0.2;
+    std::string baselineFilename;
+    std::string outputFilename;
+    double tolerance = 0.25;
+    bool qualityOnly = false;
+
+    const option longOptions[] = {{"sizes", required_argument, nullptr, 's'},
+        {"dims", required_argument, nullptr, 'd'},
+        {"min-time", required_argument, nullptr, 'm'},
+        {"baseline", required_argument, nullptr, 'b'},
+        {"write-baseline", required_argument, nullptr, 'w'},
+        {"tolerance", required_argument, nullptr, 'r'},
+        {"quality", no_argument, nullptr, 'q'},
+        {"help", no_argument, nullptr, 'h'},
+        {nullptr, 0, nullptr, 0}};
+    int opt;
+    const auto rejectValue = [&]() {
+        std::cerr << "Invalid value for option -" << static_cast<char>(opt) << ": " << optarg << "\n";
+        printUsage(argv[0]);
+        return 1;
+    };
+    while ((opt = getopt_long(argc, argv, "s:d:m:b:w:r:qh", longOptions, nullptr)) != -1)
+    {
+        switch (opt)
+        {
+        case 's':
+            if (!parseList(optarg, sizes))
+                return rejectValue();
+            break;
+        case 'd':
+            if (!parseList(optarg, dimsList))
+                return rejectValue();
+            break;
+        case 'm':
+            if (!parseValue(optarg, minTime))
+                return rejectValue();
+            break;
+        case 'b':
+            baselineFilename = optarg;
+            break;
+        case 'w':
+            outputFilename = optarg;
+            break;
+        case 'r':
+            if (!parseValue(optarg, tolerance))
+                return rejectValue();
+            break;
+        case 'q':
+            qualityOnly = true;
+            break;
+        case 'h':
+            printUsage(argv[0]);
+            return 0;
+        default:
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    bool success = runQualityCheck();
+    if (qualityOnly)
+        return success ? 0 : 1;
+
+    std::cout << "\nBenchmarks, using the " << simd::getInstructionSet() << " code path:\n";
+    const auto measures = runBenchmarks(sizes, dimsList, minTime);
+
+    if (!outputFilename.empty() && !writeBaseline(outputFilename, measures))
+    {
+        std::cerr << "Could not write baseline " << outputFilename << "\n";
+        success = false;
+    }
+
+    if (!baselineFilename.empty())
+    {
+        std::vector<Measure> baseline;
+        if (!readBaseline(baselineFilename, baseline))
+        {
+            std::cerr << "Could not read baseline " << baselineFilename << "\n";
+            success = false;
+        }
+        else
+        {
+            success = compareToBaseline(measures, baseline, tolerance) && success;
+        }
+    }
+
+    return success ? 0 : 1;
+}
@@ -16,51 +16,503 @@
  *
  */
 
+#include <getopt.h>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <optional>
 #include <random>
+#include <string>
+#include <vector>
 
 #include "./annealer.h"
+#include "./instrumentation.h"
 #include "./pattern.h"
+#include "./parse.h"
+#include "./patternfile.h"
+#include "./voidcluster.h"
 
 using namespace bluenoise;
 
-int main(int, char**)
+/*************/
+void printUsage(const char* name)
 {
-    const size_t size = 16;
-    const size_t dims = 1;
-    const double tmax = 10000.0;
+    std::cout << "Usage: " << name << " [options]\n"
+              << "Options:\n"
+              << "  -m, --method NAME      Generation method: anneal, or vac for void-and-cluster (scalar patterns only) (default: anneal)\n"
+              << "  -x, --width N          Width of the pattern (default: 16)\n"
+              << "  -y, --height N         Height of the pattern (default: 16)\n"
+              << "  -d, --dims N           Number of channels of the pattern (default: 1)\n"
+              << "  -i, --iterations N     Number of annealing iterations (default: 10000)\n"
+              << "  -t, --threads N        Number of threads used to evaluate the energy (default: all hardware threads)\n"
+              << "  -c, --chains N         Number of annealing chains run in parallel, exchanging states (default: 1)\n"
+              << "  -s, --schedule NAME    Cooling schedule: linear, exponential, logarithmic or adaptive (default: linear)\n"
+              << "  -T, --temperature T    Initial temperature (default: the iteration count)\n"
+              << "  -K, --candidates N     Number of non-interacting candidate swaps scored together at each iteration (default: 1)\n"
+              << "  -B, --selection NAME   Selection among candidate swaps: metropolis, to test each of them, or best (default: metropolis)\n"
+              << "  -L, --levels N         Number of resolution levels, each one being annealed at half the size of the next (default: 1)\n"
+              << "  -R, --refine-temp T    Initial temperature of the levels refining an expanded pattern (default: 0.1)\n"
+              << "  -b, --batch N          Number of independent patterns to generate, one per thread (default: 1)\n"
+              << "  -f, --frames N         Number of frames of a spatiotemporal sequence, decorrelated over time (default: 1)\n"
+              << "                         Frames are annealed together, use --chains or --candidates to spread them over threads\n"
+              << "  -S, --seed N           Master seed, from which each pattern gets its own random stream (default: random)\n"
+              << "  -o, --output PREFIX    Prefix of the output files (default: bluenoise)\n"
+              << "  -k, --checkpoint N     Checkpoint the annealing state every N iterations, to PREFIX.ckpt (default: 0, disabled)\n"
+              << "  -r, --resume           Resume annealing from the checkpoints, if any, given the same options and seed\n"
+              << "  -I, --stats-interval N Number of iterations between two samples of the annealing statistics (default: 10000)\n"
+              << "  -j, --telemetry FILE   Write the annealing statistics to FILE, as JSON lines\n"
+              << "  -D, --dashboard        Show the annealing statistics in a live dashboard\n"
+              << "  -F, --format NAME      Output format: png, png16, or float32 and uint16 for binary pattern files (default: png)\n"
+              << "  -h, --help             Show this help\n";
+}
+
+/*************/
+template <class A>
+bool parseSchedule(const std::string& name, typename A::Schedule& schedule)
+{
+    using Schedule = typename A::Schedule;
+    if (name == "linear")
+        schedule = Schedule::Linear;
+    else if (name == "exponential")
+        schedule = Schedule::Exponential;
+    else if (name == "logarithmic")
+        schedule = Schedule::Logarithmic;
+    else if (name == "adaptive")
+        schedule = Schedule::Adaptive;
+    else
+        return false;
+    return true;
+}
 
-    using Pat = Pattern<size, dims>;
-    using Ann = Annealer<Pat>;
+/*************/
+std::string getOutputName(const std::string& prefix, size_t job, size_t jobCount, size_t frame, size_t frameCount)
+{
+    auto name = prefix;
+    if (jobCount > 1)
+        name += "_" + std::to_string(job);
+    if (frameCount > 1)
+        name += "_frame" + std::to_string(frame);
+    return name;
+}
 
-    Ann::ErrorFunc errorFunc = [](const Pat& pattern) -> double { return pattern.getEnergy(); };
-    Ann::NeighbourFunc neighbourFunc = [](const Pat& pattern) -> Pat
+/*************/
+int main(int argc, char** argv)
+{
+    using Pat = DynamicPattern;
+    using Ann = Annealer<Pat, Pat::Swap>;
+
+    bool voidAndCluster = false;
+    size_t width = 16;
+    size_t height = 16;
+    size_t dims = 1;
+    size_t iterations = 10000;
+    size_t threadCount = 0;
+    size_t chainCount = 1;
+    Ann::Schedule schedule = Ann::Schedule::Linear;
+    double temperature = 0.0;
+    size_t candidateCount = 1;
+    Ann::BatchMode batchMode = Ann::BatchMode::Metropolis;
+    size_t levelCount = 1;
+    double refineTemperature = 0.1;
+    size_t batchCount = 1;
+    size_t frameCount = 1;
+    std::random_device rdevice;
+    std::mt19937::result_type masterSeed = rdevice();
+    std::string prefix = "bluenoise";
+    std::string format = "png";
+    size_t checkpointInterval = 0;
+    bool resume = false;
+    size_t statsInterval = 10000;
+    std::string telemetryFilename;
+    bool showDashboard = false;
+
+    const option longOptions[] = {{"method", required_argument, nullptr, 'm'},
+        {"width", required_argument, nullptr, 'x'},
+        {"height", required_argument, nullptr, 'y'},
+        {"dims", required_argument, nullptr, 'd'},
+        {"iterations", required_argument, nullptr, 'i'},
+        {"threads", required_argument, nullptr, 't'},
+        {"chains", required_argument, nullptr, 'c'},
+        {"schedule", required_argument, nullptr, 's'},
+        {"temperature", required_argument, nullptr, 'T'},
+        {"candidates", required_argument, nullptr, 'K'},
+        {"selection", required_argument, nullptr, 'B'},
+        {"levels", required_argument, nullptr, 'L'},
+        {"refine-temp", required_argument, nullptr, 'R'},
+        {"batch", required_argument, nullptr, 'b'},
+        {"frames", required_argument, nullptr, 'f'},
+        {"seed", required_argument, nullptr, 'S'},
+        {"output", required_argument, nullptr, 'o'},
+        {"format", required_argument, nullptr, 'F'},
+        {"checkpoint", required_argument, nullptr, 'k'},
+        {"resume", no_argument, nullptr, 'r'},
+        {"stats-interval", required_argument, nullptr, 'I'},
+        {"telemetry", required_argument, nullptr, 'j'},
+        {"dashboard", no_argument, nullptr, 'D'},
+        {"help", no_argument, nullptr, 'h'},
+        {nullptr, 0, nullptr, 0}};
+    int opt;
+    const auto rejectValue = [&]() {
+        std::cerr << "Invalid value for option -" << static_cast<char>(opt) << ": " << optarg << "\n";
+        printUsage(argv[0]);
+        return 1;
+    };
+    while ((opt = getopt_long(argc, argv, "m:x:y:d:i:t:c:s:T:K:B:L:R:b:f:S:o:F:k:rI:j:Dh", longOptions, nullptr)) != -1)
     {
-        static std::random_device rdevice;
-        static std::mt19937 rgen(rdevice());
-        static std::uniform_int_distribution<size_t> rdist(0, size - 1);
+        switch (opt)
+        {
+        case 'm':
+            if (std::string(optarg) == "vac")
+                voidAndCluster = true;
+            else if (std::string(optarg) == "anneal")
+                voidAndCluster = false;
+            else
+            {
+                std::cerr << "Unknown generation method: " << optarg << "\n";
+                return 1;
+            }
+            break;
+        case 'x':
+            if (!parseSize(optarg, width))
+                return rejectValue();
+            break;
+        case 'y':
+            if (!parseSize(optarg, height))
+                return rejectValue();
+            break;
+        case 'd':
+            if (!parseSize(optarg, dims))
+                return rejectValue();
+            break;
+        case 'i':
+            if (!parseSize(optarg, iterations))
+                return rejectValue();
+            break;
+        case 't':
+            if (!parseSize(optarg, threadCount))
+                return rejectValue();
+            break;
+        case 'c':
+            if (!parseSize(optarg, chainCount))
+                return rejectValue();
+            break;
+        case 's':
+            if (!parseSchedule<Ann>(optarg, schedule))
+            {
+                std::cerr << "Unknown cooling schedule: " << optarg << "\n";
+                return 1;
+            }
+            break;
+        case 'T':
+            if (!parseValue(optarg, temperature))
+                return rejectValue();
+            break;
+        case 'K':
+            if (!parseSize(optarg, candidateCount))
+                return rejectValue();
+            break;
+        case 'B':
+            if (std::string(optarg) == "metropolis")
+                batchMode = Ann::BatchMode::Metropolis;
+            else if (std::string(optarg) == "best")
+                batchMode = Ann::BatchMode::Best;
+            else
+            {
+                std::cerr << "Unknown candidate selection: " << optarg << "\n";
+                return 1;
+            }
+            break;
+        case 'L':
+            if (!parseSize(optarg, levelCount))
+                return rejectValue();
+            break;
+        case 'R':
+            if (!parseValue(optarg, refineTemperature))
+                return rejectValue();
+            break;
+        case 'b':
+            if (!parseSize(optarg, batchCount))
+                return rejectValue();
+            break;
+        case 'f':
+            if (!parseSize(optarg, frameCount))
+                return rejectValue();
+            break;
+        case 'S':
+        {
+            size_t seed;
+            if (!parseSize(optarg, seed) || seed > std::mt19937::max())
+                return rejectValue();
+            masterSeed = static_cast<std::mt19937::result_type>(seed);
+            break;
+        }
+        case 'o':
+            prefix = optarg;
+            break;
+        case 'F':
+            format = optarg;
+            if (format != "png" && format != "png16" && format != "float32" && format != "uint16")
+            {
+                std::cerr << "Unknown output format: " << optarg << "\n";
+                return 1;
+            }
+            break;
+        case 'k':
+            if (!parseSize(optarg, checkpointInterval))
+                return rejectValue();
+            break;
+        case 'r':
+            resume = true;
+            break;
+        case 'I':
+            if (!parseSize(optarg, statsInterval))
+                return rejectValue();
+            break;
+        case 'j':
+            telemetryFilename = optarg;
+            break;
+        case 'D':
+            showDashboard = true;
+            break;
+        case 'h':
+            printUsage(argv[0]);
+            return 0;
+        default:
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
 
-        auto otherPattern = pattern;
-        auto xi = rdist(rgen);
-        auto xj = rdist(rgen);
-        auto yi = rdist(rgen);
-        auto yj = rdist(rgen);
+    if (width == 0 || height == 0 || dims == 0 || batchCount == 0 || frameCount == 0)
+    {
+        std::cerr << "Pattern width, height, dims, batch and frame counts must be strictly positive\n";
+        return 1;
+    }
+
+    if (voidAndCluster && dims != 1)
+    {
+        std::cerr << "Void-and-cluster only generates scalar patterns, use annealing for vector-valued ones\n";
+        return 1;
+    }
+
+    if (levelCount == 0 || levelCount > 16 || (std::min(width, height) >> (levelCount - 1)) < 4)
+    {
+        std::cerr << "The number of levels must be strictly positive, and the coarsest level at least 4 pixels wide\n";
+        return 1;
+    }
+
+    if (voidAndCluster && levelCount != 1)
+    {
+        std::cerr << "Void-and-cluster does not support multiple resolution levels\n";
+        return 1;
+    }
+
+    if (voidAndCluster && frameCount != 1)
+    {
+        std::cerr << "Void-and-cluster only generates single frames, use annealing for spatiotemporal sequences\n";
+        return 1;
+    }
+
+    if ((format == "png" || format == "png16") && dims > 4)
+    {
+        std::cerr << "PNG images hold at most 4 channels, use a binary format for more\n";
+        return 1;
+    }
 
-        otherPattern(xi, yi) = pattern(xj, yj);
-        otherPattern(xj, yj) = pattern(xi, yi);
+    if (temperature <= 0.0)
+        temperature = static_cast<double>(iterations);
 
-        return otherPattern;
+    ThreadPool pool(threadCount);
+
+    // Toroidal kernel, so that the resulting pattern tiles seamlessly, and loops over time
+    const float sigma_i = 2.1f;
+    const float sigma_s = 1.f;
+    const float sigma_t = 1.f;
+    const size_t temporalRadius = frameCount > 1 ? EnergyKernel::getDefaultRadius(sigma_t) : 0;
+    const EnergyKernel kernel(sigma_i, sigma_s, EnergyKernel::getDefaultRadius(sigma_i), true, sigma_t, temporalRadius);
+
+    std::cout << "Master seed: " << masterSeed << "\n";
+
+    std::unique_ptr<TelemetryWriter> telemetry;
+    if (!telemetryFilename.empty())
+    {
+        telemetry = std::make_unique<TelemetryWriter>(telemetryFilename);
+        if (!telemetry->isOpen())
+        {
+            std::cerr << "Could not open " << telemetryFilename << "\n";
+            return 1;
+        }
+    }
+
+    std::unique_ptr<Dashboard> dashboard;
+    if (showDashboard && !voidAndCluster)
+        dashboard = std::make_unique<Dashboard>(batchCount);
+
+    std::mutex logMutex;
+    const auto observe = [&](size_t index, const AnnealingStats& stats) {
+        if (telemetry)
+            telemetry->record(index, stats);
+
+        if (dashboard)
+        {
+            dashboard->record(index, stats);
+        }
+        else
+        {
+            std::lock_guard<std::mutex> lock(logMutex);
+            if (batchCount > 1)
+                std::cout << "Job " << index << ", ";
+            std::cout << "iteration " << stats.iteration << "/" << stats.iterationCount << ", best error: " << stats.bestError << "\n";
+        }
+    };
+
+    // Each job gets its own random stream, derived from the master seed and its index.
+    // Patterns are only allocated by the jobs, and the initial white noise only exists
+    // for single level annealing, as other runs start from a coarser pattern or none
+    std::vector<std::optional<Pat>> initialPatterns(batchCount);
+    std::vector<std::optional<Pat>> finalPatterns(batchCount);
+    const auto job = [&](size_t index) {
+        std::seed_seq sequence{masterSeed, static_cast<std::mt19937::result_type>(index)};
+        std::mt19937 rgen(sequence);
+
+        if (voidAndCluster)
+        {
+            finalPatterns[index] = VoidAndCluster(width, height, kernel).generate(rgen);
+            return;
+        }
+
+        // Anneal one level, with swaps between any two pixels of a frame, or between
+        // neighbouring pixels when refining an expanded pattern
+        const auto anneal = [&](const Pat& initialPattern, size_t levelIterations, double levelTemperature, size_t swapRadius, const std::string& name) -> Pat {
+            Ann::ErrorFunc errorFunc = [&](const Pat& pattern) -> double { return pattern.getEnergy(kernel, &pool); };
+            Ann::ProposeFunc proposeFunc = [swapRadius](const Pat& pattern, std::mt19937& rgen) -> Pat::Swap
+            {
+                std::uniform_int_distribution<size_t> xdist(0, pattern.getWidth() - 1);
+                std::uniform_int_distribution<size_t> ydist(0, pattern.getHeight() - 1);
+                std::uniform_int_distribution<size_t> fdist(0, pattern.getFrames() - 1);
+                Pat::Swap move;
+                move.xi = xdist(rgen);
+                move.yi = ydist(rgen);
+                if (swapRadius == 0)
+                {
+                    move.xj = xdist(rgen);
+                    move.yj = ydist(rgen);
+                }
+                else
+                {
+                    std::uniform_int_distribution<size_t> offsetDist(0, 2 * swapRadius);
+                    move.xj = (move.xi + offsetDist(rgen) + pattern.getWidth() * swapRadius - swapRadius) % pattern.getWidth();
+                    move.yj = (move.yi + offsetDist(rgen) + pattern.getHeight() * swapRadius - swapRadius) % pattern.getHeight();
+                }
+                move.frame = fdist(rgen);
+                return move;
+            };
+            Ann::ApplyFunc applyFunc = [&](Pat& pattern, Pat::Swap& move, double error) -> double
+            {
+                const auto delta = pattern.getSwapEnergyDelta(move, kernel);
+                pattern.swap(move);
+                return error + delta;
+            };
+            Ann::RevertFunc revertFunc = [](Pat& pattern, Pat::Swap& move) { pattern.swap(move); };
+
+            Ann annealer(levelIterations, errorFunc, proposeFunc, applyFunc, revertFunc);
+            annealer.setSchedule(schedule, levelTemperature);
+            annealer.setChains(chainCount);
+            annealer.setThreadPool(&pool);
+            annealer.setSeed(rgen());
+            if (candidateCount > 1)
+            {
+                annealer.setBatch(
+                    candidateCount,
+                    batchMode,
+                    [&](const Pat& pattern, const Pat::Swap& move) { return pattern.getSwapEnergyDelta(move, kernel); },
+                    [](Pat& pattern, Pat::Swap& move) { pattern.swap(move); },
+                    [&](const Pat::Swap& first, const Pat::Swap& second) { return initialPattern.doSwapsInteract(first, second, kernel); });
+            }
+            annealer.setObserver([&, index](const AnnealingStats& stats) { observe(index, stats); }, statsInterval);
+            if (checkpointInterval != 0 || resume)
+            {
+                annealer.setCheckpoint(
+                    name + ".ckpt",
+                    checkpointInterval != 0 ? checkpointInterval : levelIterations,
+                    [](std::ostream& stream, const Pat& pattern) { pattern.write(stream); },
+                    [](std::istream& stream, Pat& pattern) {
+                        // States are read over copies of the initial pattern, whose shape they must have
+                        const auto width = pattern.getWidth();
+                        const auto height = pattern.getHeight();
+                        const auto dims = pattern.getDims();
+                        const auto frames = pattern.getFrames();
+                        return pattern.read(stream) && pattern.getWidth() == width && pattern.getHeight() == height && pattern.getDims() == dims && pattern.getFrames() == frames;
+                    });
+            }
+            auto pattern = annealer.cook(initialPattern, resume);
+
+            std::lock_guard<std::mutex> lock(logMutex);
+            if (resume && !annealer.hasResumed())
+                std::cerr << "Could not resume from checkpoint " << name << ".ckpt, it was started over\n";
+            if (!annealer.hasWrittenCheckpoints())
+                std::cerr << "Could not write checkpoint " << name << ".ckpt\n";
+            return pattern;
+        };
+
+        const auto name = getOutputName(prefix, index, batchCount, 0, 1);
+        if (levelCount == 1)
+        {
+            initialPatterns[index].emplace(width, height, dims, frameCount, rgen());
+            finalPatterns[index] = anneal(*initialPatterns[index], iterations, temperature, 0, name);
+            return;
+        }
+
+        // Multiresolution: the coarsest level settles the large scale structure, then each
+        // level is expanded to twice its size and refined locally. Iteration budgets are
+        // proportional to the pixel count of each level, the finest level getting them all
+        const auto getScale = [&](size_t level) { return size_t(1) << (levelCount - 1 - level); };
+        const auto getLevelSize = [&](size_t level, size_t length) { return (length + getScale(level) - 1) / getScale(level); };
+        const auto getLevelIterations = [&](size_t level) { return std::max<size_t>(iterations / (getScale(level) * getScale(level)), 1); };
+        const auto getLevelName = [&](size_t level) { return name + "_level" + std::to_string(level); };
+
+        auto pattern = anneal(Pat(getLevelSize(0, width), getLevelSize(0, height), dims, frameCount, rgen()), getLevelIterations(0), temperature, 0, getLevelName(0));
+        for (size_t level = 1; level < levelCount; ++level)
+        {
+            pattern = pattern.getExpanded(getLevelSize(level, width), getLevelSize(level, height), rgen());
+            pattern = anneal(pattern, getLevelIterations(level), refineTemperature, kernel.getRadius(), getLevelName(level));
+        }
+        finalPatterns[index] = std::move(pattern);
     };
 
-    Ann annealer(tmax, errorFunc, neighbourFunc);
-    Pat initialPattern;
-    auto finalPattern = annealer.cook(initialPattern);
+    // With a single job, the pool is left to the energy evaluation and the chains
+    pool.run(batchCount, job);
+    dashboard.reset();
+
+    // Save the images to disk
+    if (batchCount == 1 && frameCount == 1 && initialPatterns[0])
+    {
+        const auto name = getOutputName(prefix, 0, 1, 0, 1) + "_whitenoise";
+        initialPatterns[0]->saveToFile(name + ".png");
+        initialPatterns[0]->saveFourier(name + "_fourier.png");
+        initialPatterns[0]->saveSpectrum(name + "_spectrum.csv");
+    }
+
+    for (size_t index = 0; index < batchCount; ++index)
+    {
+        if (format == "float32" || format == "uint16")
+        {
+            const auto sampleType = format == "float32" ? PatternFile::SampleType::Float32 : PatternFile::SampleType::UInt16;
+            const auto name = getOutputName(prefix, index, batchCount, 0, 1) + ".bnp";
+            if (!PatternFile::save(name, *finalPatterns[index], sampleType, kernel, masterSeed))
+                std::cerr << "Could not write " << name << "\n";
+        }
 
-    // Save the image to disk
-    initialPattern.saveToFile("whitenoise.png");
-    initialPattern.saveFourier("bluenoise_fourier.png");
-    finalPattern.saveToFile("bluenoise.png");
-    finalPattern.saveFourier("whitenoise_fourier.png");
+        for (size_t frame = 0; frame < frameCount; ++frame)
+        {
+            const auto pattern = finalPatterns[index]->getFrame(frame);
+            const auto name = getOutputName(prefix, index, batchCount, frame, frameCount);
+            if (format == "png" || format == "png16")
+                pattern.saveToFile(name + ".png", format == "png16" ? 16 : 8);
+            pattern.saveFourier(name + "_fourier.png");
+            pattern.saveSpectrum(name + "_spectrum.csv");
+        }
+    }
 
     return 0;
 }
@@ -0,0 +1,159 @@
+/*
+ * Copyright (C) 2019 Emmanuel Durand
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Splash is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#pragma once
+
+#include <cassert>
+#include <cmath>
+#include <complex>
+#include <cstddef>
+#include <vector>
+
+namespace bluenoise
+{
+
+/**
+ * One-dimensional discrete Fourier transform of a given length
+ * Power-of-two lengths use an iterative radix-2 transform, other lengths are
+ * handled with Bluestein's algorithm on top of it. Twiddle factors and chirps
+ * are computed once, at construction.
+ */
+class FFT
+{
+  public:
+    using Complex = std::complex<double>;
+
+    /**
+     * Constructor
+     * \param length Length of the transform
+     */
+    explicit FFT(size_t length)
+        : _length(length)
+    {
+        assert(length != 0);
+
+        if (isPowerOfTwo(length))
+        {
+            _radixLength = length;
+            computeTwiddles();
+            return;
+        }
+
+        // Bluestein: the transform is expressed as a convolution with a chirp,
+        // evaluated with power-of-two transforms of length at least 2n - 1
+        _radixLength = 1;
+        while (_radixLength < 2 * length - 1)
+            _radixLength *= 2;
+        computeTwiddles();
+
+        _chirp.resize(length);
+        for (size_t k = 0; k < length; ++k)
+        {
+            // k^2 is reduced modulo 2n to keep the angle accurate for large k
+            const auto sqIndex = static_cast<double>((k * k) % (2 * length));
+            _chirp[k] = std::polar(1.0, -M_PI * sqIndex / static_cast<double>(length));
+        }
+
+        _chirpFilter.assign(_radixLength, Complex(0.0, 0.0));
+        _chirpFilter[0] = std::conj(_chirp[0]);
+        for (size_t k = 1; k < length; ++k)
+            _chirpFilter[k] = _chirpFilter[_radixLength - k] = std::conj(_chirp[k]);
+        transformRadix2(_chirpFilter.data());
+    }
+
+    /**
+     * Get the length of the transform
+     * \return Return the length
+     */
+    size_t getLength() const { return _length; }
+
+    /**
+     * Apply the forward transform in place
+     * \param data Data to transform, of the length of the transform
+     */
+    void transform(Complex* data) const
+    {
+        if (_chirp.empty())
+        {
+            transformRadix2(data);
+            return;
+        }
+
+        std::vector<Complex> buffer(_radixLength, Complex(0.0, 0.0));
+        for (size_t k = 0; k < _length; ++k)
+            buffer[k] = data[k] * _chirp[k];
+
+        transformRadix2(buffer.data());
+        for (size_t k = 0; k < _radixLength; ++k)
+            buffer[k] = std::conj(buffer[k] * _chirpFilter[k]);
+
+        // Inverse transform, through the conjugate of the forward one
+        transformRadix2(buffer.data());
+        const auto scale = 1.0 / static_cast<double>(_radixLength);
+        for (size_t k = 0; k < _length; ++k)
+            data[k] = std::conj(buffer[k]) * scale * _chirp[k];
+    }
+
+  private:
+    size_t _length{0};
+    size_t _radixLength{0};
+    std::vector<Complex> _twiddles{};
+    std::vector<Complex> _chirp{};
+    std::vector<Complex> _chirpFilter{};
+
+    static bool isPowerOfTwo(size_t value) { return (value & (value - 1)) == 0; }
+
+    void computeTwiddles()
+    {
+        _twiddles.resize(_radixLength / 2);
+        for (size_t k = 0; k < _twiddles.size(); ++k)
+            _twiddles[k] = std::polar(1.0, -2.0 * M_PI * static_cast<double>(k) / static_cast<double>(_radixLength));
+    }
+
+    void transformRadix2(Complex* data) const
+    {
+        const auto n = _radixLength;
+
+        // Bit reversal permutation
+        for (size_t i = 1, j = 0; i < n; ++i)
+        {
+            size_t bit = n >> 1;
+            for (; j & bit; bit >>= 1)
+                j ^= bit;
+            j ^= bit;
+            if (i < j)
+                std::swap(data[i], data[j]);
+        }
+
+        for (size_t half = 1; half < n; half *= 2)
+        {
+            const auto twiddleStride = n / (2 * half);
+            for (size_t start = 0; start < n; start += 2 * half)
+            {
+                for (size_t k = 0; k < half; ++k)
+                {
+                    const auto odd = data[start + k + half] * _twiddles[k * twiddleStride];
+                    data[start + k + half] = data[start + k] - odd;
+                    data[start + k] += odd;
+                }
+            }
+        }
+    }
+};
+
+} // namespace bluenoise
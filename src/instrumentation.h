@@ -0,0 +1,178 @@
+/*
+ * Copyright (C) 2019 Emmanuel Durand
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Splash is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#define NCURSES_NOMACROS
+#include <ncurses.h>
+
+#include "./annealer.h"
+
+namespace bluenoise
+{
+
+/**
+ * Writer of annealing statistics as JSON lines, one object per sample
+ * Samples from multiple jobs can be recorded concurrently.
+ */
+class TelemetryWriter
+{
+  public:
+    /**
+     * Constructor
+     * \param filename Path to the output file, which is overwritten
+     */
+    explicit TelemetryWriter(const std::string& filename)
+        : _file(filename, std::ios::trunc)
+    {
+        _file << std::setprecision(10);
+    }
+
+    /**
+     * Get whether the output file could be opened
+     * \return Return true if it is open
+     */
+    bool isOpen() const { return _file.is_open(); }
+
+    /**
+     * Record a sample
+     * \param job Index of the job the sample belongs to
+     * \param stats Sampled statistics
+     */
+    void record(size_t job, const AnnealingStats& stats)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _file << "{\"job\":" << job << ",\"iteration\":" << stats.iteration << ",\"iterationCount\":" << stats.iterationCount << ",\"elapsed\":" << stats.elapsed
+              << ",\"iterationsPerSecond\":" << stats.iterationsPerSecond << ",\"acceptanceRate\":" << stats.acceptanceRate << ",\"currentError\":" << stats.currentError
+              << ",\"bestError\":" << stats.bestError << ",\"temperature\":" << stats.temperature << "}\n";
+    }
+
+  private:
+    std::mutex _mutex{};
+    std::ofstream _file;
+};
+
+/**
+ * Live terminal dashboard, showing the latest statistics of each job
+ * The terminal is handed over to ncurses for the lifetime of the object. Redraws are
+ * throttled, so that recording samples stays cheap whatever their rate.
+ */
+class Dashboard
+{
+  public:
+    /**
+     * Constructor
+     * \param jobCount Number of jobs to show
+     */
+    explicit Dashboard(size_t jobCount)
+        : _stats(jobCount)
+        , _startTime(std::chrono::steady_clock::now())
+    {
+        initscr();
+        noecho();
+        curs_set(0);
+        draw();
+    }
+
+    /**
+     * Destructor, restoring the terminal
+     */
+    ~Dashboard()
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            draw();
+        }
+        endwin();
+    }
+
+    Dashboard(const Dashboard&) = delete;
+    Dashboard& operator=(const Dashboard&) = delete;
+
+    /**
+     * Record a sample
+     * \param job Index of the job the sample belongs to
+     * \param stats Sampled statistics
+     */
+    void record(size_t job, const AnnealingStats& stats)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (job >= _stats.size())
+            return;
+        _stats[job] = stats;
+
+        const auto now = std::chrono::steady_clock::now();
+        if (now - _lastDraw < _drawInterval)
+            return;
+        _lastDraw = now;
+        draw();
+    }
+
+  private:
+    static constexpr std::chrono::milliseconds _drawInterval{100};
+    static constexpr int _barWidth{20};
+
+    std::mutex _mutex{};
+    std::vector<AnnealingStats> _stats;
+    std::chrono::steady_clock::time_point _startTime;
+    std::chrono::steady_clock::time_point _lastDraw{};
+
+    void draw()
+    {
+        const auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - _startTime).count();
+
+        erase();
+        mvprintw(0, 0, "bluenoise - %zu job(s), %.1fs elapsed", _stats.size(), elapsed);
+        mvprintw(2, 0, "%-5s %-*s %12s %8s %14s %14s %12s", "job", _barWidth + 9, "progress", "it/s", "accept", "current", "best", "temperature");
+
+        const auto rows = std::max(getmaxy(stdscr) - 3, 0);
+        for (size_t job = 0; job < _stats.size() && static_cast<int>(job) < rows; ++job)
+        {
+            const auto& stats = _stats[job];
+            const auto progress = stats.iterationCount ? static_cast<double>(stats.iteration) / static_cast<double>(stats.iterationCount) : 0.0;
+            const auto filled = static_cast<int>(progress * _barWidth);
+
+            std::string bar(_barWidth, '.');
+            std::fill(bar.begin(), bar.begin() + std::clamp(filled, 0, _barWidth), '#');
+            mvprintw(static_cast<int>(job) + 3,
+                0,
+                "%-5zu [%s] %5.1f%% %12.4g %8.3f %14.6g %14.6g %12.4g",
+                job,
+                bar.c_str(),
+                100.0 * progress,
+                stats.iterationsPerSecond,
+                stats.acceptanceRate,
+                stats.currentError,
+                stats.bestError,
+                stats.temperature);
+        }
+
+        refresh();
+    }
+};
+
+} // namespace bluenoise
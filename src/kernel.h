@@ -0,0 +1,399 @@
+/*
+ * Copyright (C) 2019 Emmanuel Durand
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Splash is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <cstdlib>
+#include <vector>
+
+#include "./simd.h"
+
+namespace bluenoise
+{
+
+/**
+ * Energy kernel, holding the parameters of the pattern energy
+ * The spatial term exp(-d^2 / sigma_i^2) is precomputed for every (dx, dy) offset
+ * within the cutoff radius, so that it is a lookup when evaluating pairs of pixels.
+ * For patterns with multiple frames, it also holds a temporal term exp(-dt^2 / sigma_t^2).
+ */
+class EnergyKernel
+{
+  public:
+    /**
+     * Constructor
+     * \param sigma_i Sigma_i, per the article
+     * \param sigma_s Sigma_s, per the article
+     * \param radius Cutoff radius, pairs further apart than this along either axis are ignored
+     * \param toroidal If true, distances wrap around the pattern borders, which makes it tileable
+     * \param sigma_t Sigma of the temporal term, for patterns with multiple frames
+     * \param temporalRadius Cutoff radius along time, 0 to ignore pairs between frames
+     */
+    EnergyKernel(const float sigma_i = 2.1f,
+        const float sigma_s = 1.f,
+        const size_t radius = getDefaultRadius(2.1f),
+        const bool toroidal = true,
+        const float sigma_t = 1.f,
+        const size_t temporalRadius = 0)
+        : _sigma_i(sigma_i)
+        , _sqSigma_s(sigma_s * sigma_s)
+        , _sigma_t(sigma_t)
+        , _radius(radius)
+        , _temporalRadius(temporalRadius)
+        , _toroidal(toroidal)
+    {
+        assert(sigma_i > 0.f);
+        assert(sigma_s > 0.f);
+        assert(sigma_t > 0.f);
+
+        const float sqSigma_i = sigma_i * sigma_i;
+        const float sqSigma_t = sigma_t * sigma_t;
+        const auto side = getSide();
+        const auto depth = 2 * _temporalRadius + 1;
+        _weights.resize(side * side * depth);
+        for (size_t t = 0; t < depth; ++t)
+        {
+            for (size_t y = 0; y < side; ++y)
+            {
+                for (size_t x = 0; x < side; ++x)
+                {
+                    const auto dx = static_cast<float>(x) - static_cast<float>(_radius);
+                    const auto dy = static_cast<float>(y) - static_cast<float>(_radius);
+                    const auto dt = static_cast<float>(t) - static_cast<float>(_temporalRadius);
+                    _weights[(t * side + y) * side + x] = std::exp(-(dx * dx + dy * dy) / sqSigma_i - dt * dt / sqSigma_t);
+                }
+            }
+        }
+    }
+
+    /**
+     * Get the radius beyond which the spatial term is below float epsilon
+     * \param sigma_i Sigma_i, per the article
+     * \return Return the radius
+     */
+    static size_t getDefaultRadius(const float sigma_i) { return static_cast<size_t>(std::ceil(4.f * sigma_i)); }
+
+    /**
+     * Get the cutoff radius
+     * \return Return the radius
+     */
+    size_t getRadius() const { return _radius; }
+
+    /**
+     * Get the cutoff radius to use for a given pattern side length
+     * In toroidal mode it is limited to half the length, see getFirstOffset.
+     * \param length Side length of the pattern
+     * \return Return the radius
+     */
+    size_t getRadius(const size_t length) const
+    {
+        if (length == 0)
+            return 0;
+        return std::min(_radius, _toroidal ? length / 2 : length - 1);
+    }
+
+    /**
+     * Get the temporal cutoff radius
+     * \return Return the radius
+     */
+    size_t getTemporalRadius() const { return _temporalRadius; }
+
+    /**
+     * Get the temporal cutoff radius to use for a given frame count
+     * \param frames Number of frames of the pattern
+     * \return Return the radius
+     */
+    size_t getTemporalRadius(const size_t frames) const
+    {
+        if (frames == 0)
+            return 0;
+        return std::min(_temporalRadius, _toroidal ? frames / 2 : frames - 1);
+    }
+
+    /**
+     * Get the first offset of a neighbourhood along one axis, the last one being the radius
+     * On a toroidal axis of even length, the offsets -length / 2 and length / 2 reach the
+     * same pixel. Only the latter is kept, so that every pixel is reached exactly once.
+     * \param length Side length of the pattern along this axis
+     * \param radius Radius along this axis, as given by getRadius or getTemporalRadius
+     * \return Return the first offset
+     */
+    int getFirstOffset(const size_t length, const size_t radius) const
+    {
+        const auto first = -static_cast<int>(radius);
+        return _toroidal && 2 * radius == length ? first + 1 : first;
+    }
+
+    /**
+     * Get sigma_i
+     * \return Return sigma_i
+     */
+    float getSigmaI() const { return _sigma_i; }
+
+    /**
+     * Get the squared sigma_s
+     * \return Return sigma_s^2
+     */
+    float getSqSigmaS() const { return _sqSigma_s; }
+
+    /**
+     * Get the sigma of the temporal term
+     * \return Return sigma_t
+     */
+    float getSigmaT() const { return _sigma_t; }
+
+    /**
+     * Get whether distances wrap around the pattern borders
+     * \return Return true if toroidal
+     */
+    bool isToroidal() const { return _toroidal; }
+
+    /**
+     * Get the spatial weight for a given offset
+     * \param dx Offset along X, within [-radius, radius]
+     * \param dy Offset along Y, within [-radius, radius]
+     * \param dt Offset along time, within [-temporalRadius, temporalRadius]
+     * \return Return exp(-(dx^2 + dy^2) / sigma_i^2 - dt^2 / sigma_t^2)
+     */
+    float getSpatialWeight(const int dx, const int dy, const int dt = 0) const { return *getSpatialWeights(dx, dy, dt); }
+
+    /**
+     * Get the spatial weights for a row of offsets, starting at the given one
+     * Weights for increasing dx are contiguous, up to dx = radius.
+     * \param dx Offset along X, within [-radius, radius]
+     * \param dy Offset along Y, within [-radius, radius]
+     * \param dt Offset along time, within [-temporalRadius, temporalRadius]
+     * \return Return a pointer to the weights
+     */
+    const float* getSpatialWeights(const int dx, const int dy, const int dt = 0) const
+    {
+        assert(static_cast<size_t>(std::abs(dx)) <= _radius);
+        assert(static_cast<size_t>(std::abs(dy)) <= _radius);
+        assert(static_cast<size_t>(std::abs(dt)) <= _temporalRadius);
+        const auto radius = static_cast<int>(_radius);
+        const auto side = static_cast<int>(getSide());
+        return &_weights[((dt + static_cast<int>(_temporalRadius)) * side + dy + radius) * side + dx + radius];
+    }
+
+    /**
+     * Get the value term of the energy for a pair of pixels
+     * \param ps Values of the first pixel
+     * \param qs Values of the second pixel
+     * \return Return exp(-|ps - qs|^dims / sigma_s^2)
+     */
+    template <size_t dims>
+    float getValueWeight(const float* ps, const float* qs) const
+    {
+        float sqValueDist = 0.f;
+        for (size_t c = 0; c < dims; ++c)
+            sqValueDist += (ps[c] - qs[c]) * (ps[c] - qs[c]);
+        return std::exp(-simd::powHalfDims<dims>(sqValueDist) / _sqSigma_s);
+    }
+
+    /**
+     * Get the value term of the energy for a pair of pixels, for any channel count
+     * \param ps Values of the first pixel
+     * \param qs Values of the second pixel
+     * \param dims Number of channels
+     * \return Return exp(-|ps - qs|^dims / sigma_s^2)
+     */
+    float getValueWeight(const float* ps, const float* qs, const size_t dims) const
+    {
+        float sqValueDist = 0.f;
+        for (size_t c = 0; c < dims; ++c)
+            sqValueDist += (ps[c] - qs[c]) * (ps[c] - qs[c]);
+        return std::exp(-std::pow(sqValueDist, static_cast<float>(dims) / 2.f) / _sqSigma_s);
+    }
+
+    /**
+     * Get the summed energy of the pairs between a pixel and a contiguous row of pixels
+     * The row is processed in SIMD lanes, the spatial weights being read from the LUT.
+     * \param ps Values of the pixel
+     * \param qs Values of the first pixel of the row
+     * \param weights Spatial weights for the pixels of the row, see getSpatialWeights
+     * \param count Number of pixels in the row
+     * \return Return the summed energy
+     */
+    template <size_t dims>
+    float getRowEnergy(const float* ps, const float* qs, const float* weights, const size_t count) const
+    {
+        using simd::FloatPack;
+
+        const auto p = broadcast<dims>(ps);
+
+        auto energy = FloatPack::zero();
+        size_t n = 0;
+        for (; n + FloatPack::width <= count; n += FloatPack::width)
+            energy = FloatPack::fma(FloatPack::load(&weights[n]), getValueWeights<dims>(p, &qs[n * dims]), energy);
+
+        float result = energy.sum();
+        for (; n < count; ++n)
+            result += weights[n] * getValueWeight<dims>(ps, &qs[n * dims]);
+        return result;
+    }
+
+    /**
+     * Get the energy variation of the pairs between a pixel and a contiguous row of pixels,
+     * when the values of the pixel are replaced
+     * \param ps Current values of the pixel
+     * \param qs New values of the pixel
+     * \param ks Values of the first pixel of the row
+     * \param weights Spatial weights for the pixels of the row, see getSpatialWeights
+     * \param count Number of pixels in the row
+     * \return Return the energy variation
+     */
+    template <size_t dims>
+    float getRowEnergyDelta(const float* ps, const float* qs, const float* ks, const float* weights, const size_t count) const
+    {
+        using simd::FloatPack;
+
+        const auto p = broadcast<dims>(ps);
+        const auto q = broadcast<dims>(qs);
+
+        auto delta = FloatPack::zero();
+        size_t n = 0;
+        for (; n + FloatPack::width <= count; n += FloatPack::width)
+        {
+            const auto diff = getValueWeights<dims>(q, &ks[n * dims]) - getValueWeights<dims>(p, &ks[n * dims]);
+            delta = FloatPack::fma(FloatPack::load(&weights[n]), diff, delta);
+        }
+
+        float result = delta.sum();
+        for (; n < count; ++n)
+            result += weights[n] * (getValueWeight<dims>(qs, &ks[n * dims]) - getValueWeight<dims>(ps, &ks[n * dims]));
+        return result;
+    }
+
+    /**
+     * Get the summed energy of the pairs between a pixel and a contiguous row of pixels, for any channel count
+     * \param ps Values of the pixel
+     * \param qs Values of the first pixel of the row
+     * \param weights Spatial weights for the pixels of the row, see getSpatialWeights
+     * \param count Number of pixels in the row
+     * \param dims Number of channels
+     * \return Return the summed energy
+     */
+    float getRowEnergy(const float* ps, const float* qs, const float* weights, const size_t count, const size_t dims) const
+    {
+        float result = 0.f;
+        for (size_t n = 0; n < count; ++n)
+            result += weights[n] * getValueWeight(ps, &qs[n * dims], dims);
+        return result;
+    }
+
+    /**
+     * Get the energy variation of the pairs between a pixel and a contiguous row of pixels,
+     * when the values of the pixel are replaced, for any channel count
+     * \param ps Current values of the pixel
+     * \param qs New values of the pixel
+     * \param ks Values of the first pixel of the row
+     * \param weights Spatial weights for the pixels of the row, see getSpatialWeights
+     * \param count Number of pixels in the row
+     * \param dims Number of channels
+     * \return Return the energy variation
+     */
+    float getRowEnergyDelta(const float* ps, const float* qs, const float* ks, const float* weights, const size_t count, const size_t dims) const
+    {
+        float result = 0.f;
+        for (size_t n = 0; n < count; ++n)
+            result += weights[n] * (getValueWeight(qs, &ks[n * dims], dims) - getValueWeight(ps, &ks[n * dims], dims));
+        return result;
+    }
+
+    /**
+     * Get the offset from a coordinate to another along one axis, if within the given radius
+     * \param from Reference coordinate
+     * \param to Target coordinate
+     * \param length Side length of the pattern along this axis
+     * \param radius Radius to search within
+     * \param offset Set to the offset
+     * \return Return false if the target is further than the radius
+     */
+    bool getOffset(const size_t from, const size_t to, const size_t length, const size_t radius, int& offset) const
+    {
+        offset = static_cast<int>(to) - static_cast<int>(from);
+        if (_toroidal && static_cast<size_t>(std::abs(offset)) > length / 2)
+            offset += offset < 0 ? static_cast<int>(length) : -static_cast<int>(length);
+        return static_cast<size_t>(std::abs(offset)) <= radius;
+    }
+
+    /**
+     * Get the coordinate of a neighbour along one axis
+     * \param coord Coordinate of the reference pixel
+     * \param offset Offset to the neighbour
+     * \param length Side length of the pattern along this axis
+     * \param neighbour Set to the coordinate of the neighbour
+     * \return Return false if the neighbour falls outside of a non-toroidal pattern
+     */
+    bool getNeighbour(const size_t coord, const int offset, const size_t length, size_t& neighbour) const
+    {
+        const auto n = static_cast<int>(coord) + offset;
+        if (n >= 0 && n < static_cast<int>(length))
+        {
+            neighbour = static_cast<size_t>(n);
+            return true;
+        }
+
+        if (!_toroidal)
+            return false;
+
+        neighbour = static_cast<size_t>(n < 0 ? n + static_cast<int>(length) : n - static_cast<int>(length));
+        return true;
+    }
+
+  private:
+    float _sigma_i{2.1f};
+    float _sqSigma_s{1.f};
+    float _sigma_t{1.f};
+    size_t _radius{0};
+    size_t _temporalRadius{0};
+    bool _toroidal{true};
+    std::vector<float> _weights{};
+
+    size_t getSide() const { return 2 * _radius + 1; }
+
+    template <size_t dims>
+    static std::array<simd::FloatPack, dims> broadcast(const float* ps)
+    {
+        std::array<simd::FloatPack, dims> p;
+        for (size_t c = 0; c < dims; ++c)
+            p[c] = simd::FloatPack::broadcast(ps[c]);
+        return p;
+    }
+
+    template <size_t dims>
+    simd::FloatPack getValueWeights(const std::array<simd::FloatPack, dims>& p, const float* qs) const
+    {
+        using simd::FloatPack;
+
+        auto sqValueDist = FloatPack::zero();
+        for (size_t c = 0; c < dims; ++c)
+        {
+            const auto diff = p[c] - FloatPack::loadStrided<dims>(&qs[c]);
+            sqValueDist = FloatPack::fma(diff, diff, sqValueDist);
+        }
+        return FloatPack::exp(simd::powHalfDims<dims>(sqValueDist) * FloatPack::broadcast(-1.f / _sqSigma_s));
+    }
+};
+
+} // namespace bluenoise
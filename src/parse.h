@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2019 Emmanuel Durand
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Splash is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#pragma once
+
+#include <cctype>
+#include <cerrno>
+#include <cmath>
+#include <cstdlib>
+#include <string>
+
+namespace bluenoise
+{
+
+/**
+ * Parse a non-negative integer, as given on the command line
+ * Only digits are accepted, so that negative values are not wrapped around.
+ * \param text Text to parse
+ * \param value Set to the parsed value
+ * \return Return false if the text is not a non-negative integer, or is out of range
+ */
+inline bool parseSize(const std::string& text, size_t& value)
+{
+    if (text.empty())
+        return false;
+    for (const auto character : text)
+        if (!std::isdigit(static_cast<unsigned char>(character)))
+            return false;
+
+    errno = 0;
+    const auto result = std::strtoull(text.c_str(), nullptr, 10);
+    if (errno == ERANGE || result > static_cast<unsigned long long>(static_cast<size_t>(-1)))
+        return false;
+    value = static_cast<size_t>(result);
+    return true;
+}
+
+/**
+ * Parse a non-negative real number, as given on the command line
+ * \param text Text to parse
+ * \param value Set to the parsed value
+ * \return Return false if the text is not a finite, non-negative number
+ */
+inline bool parseValue(const std::string& text, double& value)
+{
+    if (text.empty() || std::isspace(static_cast<unsigned char>(text.front())))
+        return false;
+
+    char* end = nullptr;
+    errno = 0;
+    const auto result = std::strtod(text.c_str(), &end);
+    if (*end != '\0' || errno == ERANGE || !std::isfinite(result) || result < 0.0)
+        return false;
+    value = result;
+    return true;
+}
+
+} // namespace bluenoise
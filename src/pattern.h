@@ -16,22 +16,47 @@
  *
  */
 
+#pragma once
+
+#include <algorithm>
 #include <array>
 #include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <new>
 #include <random>
+#include <string>
 #include <type_traits>
+#include <utility>
+#include <vector>
 
+// The writer is compiled with internal linkage, so that this header can be included
+// from several translation units of the same binary, as does the runtime library
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-function"
+#define STB_IMAGE_WRITE_STATIC
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include <stb_image_write.h>
+#pragma GCC diagnostic pop
+
+#include "./fft.h"
+#include "./kernel.h"
+#include "./threadpool.h"
 
 namespace bluenoise
 {
 
 /**
- * Noise pattern, basically an image
+ * Noise pattern, basically an image, whose size is set at runtime
+ * Data is stored on the heap, interleaved per pixel and aligned for SIMD loads.
  */
-template <size_t size, size_t dims = 1>
-class Pattern
+class DynamicPattern
 {
   public:
     class ConstView;
@@ -40,34 +65,38 @@ class Pattern
         friend ConstView;
 
       public:
-        View(float* ptr)
+        View(const View&) = default;
+        View(float* ptr, size_t dims)
+            : _data(ptr)
+            , _dims(dims)
         {
-            for (size_t i = 0; i < dims; ++i)
-                _data[i] = &ptr[i];
         }
 
-        float& operator[](size_t index) { return *_data[index]; }
+        float& operator[](size_t index)
+        {
+            assert(index < _dims);
+            return _data[index];
+        }
 
         View& operator=(const View& rhs)
         {
             if (this == &rhs)
                 return *this;
 
-            for (size_t i = 0; i < dims; ++i)
-                *_data[i] = *rhs._data[i];
-
+            assert(_dims == rhs._dims);
+            std::memmove(_data, rhs._data, _dims * sizeof(float));
             return *this;
         }
         View& operator=(const ConstView& rhs)
         {
-            for (size_t i = 0; i < dims; ++i)
-                *_data[i] = *rhs._data[i];
-
+            assert(_dims == rhs._dims);
+            std::memmove(_data, rhs._data, _dims * sizeof(float));
             return *this;
         }
 
       protected:
-        std::array<float*, dims> _data;
+        float* _data;
+        size_t _dims;
     };
 
     class ConstView
@@ -75,46 +104,132 @@ class Pattern
         friend View;
 
       public:
-        ConstView(const float* ptr)
+        ConstView(const float* ptr, size_t dims)
+            : _data(ptr)
+            , _dims(dims)
         {
-            for (size_t i = 0; i < dims; ++i)
-                _data[i] = &ptr[i];
         }
 
-        const float& operator[](size_t index) { return *_data[index]; }
+        const float& operator[](size_t index) const
+        {
+            assert(index < _dims);
+            return _data[index];
+        }
 
       protected:
-        std::array<const float*, dims> _data;
+        const float* _data;
+        size_t _dims;
+    };
+
+    /**
+     * Swap of the values of two pixels, usable as an in-place annealing move
+     */
+    struct Swap
+    {
+        size_t xi{0};
+        size_t yi{0};
+        size_t xj{0};
+        size_t yj{0};
+        size_t frame{0};
     };
 
   public:
     /**
-     * Constructor
+     * Constructor, filling the pattern with white noise
+     * \param width Width of the pattern
+     * \param height Height of the pattern
+     * \param dims Number of channels
+     * \param frames Number of frames, for spatiotemporal patterns
      */
-    Pattern()
+    DynamicPattern(size_t width, size_t height, size_t dims = 1, size_t frames = 1)
+        : DynamicPattern(width, height, dims, frames, getRandomSeed())
+    {
+    }
+
+    /**
+     * Constructor, filling the pattern with white noise drawn from the given seed
+     * \param width Width of the pattern
+     * \param height Height of the pattern
+     * \param dims Number of channels
+     * \param frames Number of frames, for spatiotemporal patterns
+     * \param seed Seed of the random generator
+     */
+    DynamicPattern(size_t width, size_t height, size_t dims, size_t frames, std::mt19937::result_type seed)
+        : _width(width)
+        , _height(height)
+        , _dims(dims)
+        , _frames(frames)
+        , _data(allocate(width * height * dims * frames))
     {
-        assert(size != 0);
+        assert(width != 0);
+        assert(height != 0);
         assert(dims != 0);
+        assert(frames != 0);
 
-        std::random_device rdevice;
-        std::mt19937 rgen(rdevice());
+        std::mt19937 rgen(seed);
         std::uniform_real_distribution<float> rdist(0.f, 1.f);
-        for (size_t i = 0; i < _count; ++i)
+        for (size_t i = 0; i < getCount(); ++i)
             _data[i] = rdist(rgen);
     }
 
+    DynamicPattern(const DynamicPattern& other)
+        : _width(other._width)
+        , _height(other._height)
+        , _dims(other._dims)
+        , _frames(other._frames)
+        , _data(allocate(other.getCount()))
+    {
+        std::memcpy(_data.get(), other._data.get(), getCount() * sizeof(float));
+    }
+
+    DynamicPattern(DynamicPattern&&) = default;
+
+    DynamicPattern& operator=(const DynamicPattern& other)
+    {
+        if (this == &other)
+            return *this;
+
+        if (!_data || getCount() != other.getCount())
+            _data = allocate(other.getCount());
+        _width = other._width;
+        _height = other._height;
+        _dims = other._dims;
+        _frames = other._frames;
+        std::memcpy(_data.get(), other._data.get(), getCount() * sizeof(float));
+        return *this;
+    }
+
+    DynamicPattern& operator=(DynamicPattern&&) = default;
+
     View operator()(const size_t x, const size_t y)
     {
-        assert(x < size);
-        assert(y < size);
-        View value(&_data[(y * size + x) * dims]);
+        assert(x < _width);
+        assert(y < _height);
+        View value(&_data[(y * _width + x) * _dims], _dims);
         return value;
     }
     ConstView operator()(const size_t x, const size_t y) const
     {
-        assert(x < size);
-        assert(y < size);
-        ConstView value(&_data[(y * size + x) * dims]);
+        assert(x < _width);
+        assert(y < _height);
+        ConstView value(&_data[(y * _width + x) * _dims], _dims);
+        return value;
+    }
+
+    View operator()(const size_t x, const size_t y, const size_t frame)
+    {
+        assert(x < _width);
+        assert(y < _height);
+        assert(frame < _frames);
+        View value(&_data[getOffset(x, y, frame)], _dims);
+        return value;
+    }
+    ConstView operator()(const size_t x, const size_t y, const size_t frame) const
+    {
+        assert(x < _width);
+        assert(y < _height);
+        assert(frame < _frames);
+        ConstView value(&_data[getOffset(x, y, frame)], _dims);
         return value;
     }
 
@@ -122,147 +237,828 @@ class Pattern
      * Get a pointer to the data
      * \return Return a pointer to the data
      */
-    float* data() const { return _data.data(); }
+    float* data() { return _data.get(); }
+    const float* data() const { return _data.get(); }
 
     /**
-     * Generate the Fourier transform for this pattern, and save it
-     * \param filename Path to save the Fourier transform to
+     * Get the width of the pattern
+     * \return Return the width
      */
-    void saveFourier(const std::string& filename) const
+    size_t getWidth() const { return _width; }
+
+    /**
+     * Get the height of the pattern
+     * \return Return the height
+     */
+    size_t getHeight() const { return _height; }
+
+    /**
+     * Get the number of channels of the pattern
+     * \return Return the channel count
+     */
+    size_t getDims() const { return _dims; }
+
+    /**
+     * Get the number of frames of the pattern
+     * \return Return the frame count
+     */
+    size_t getFrames() const { return _frames; }
+
+    /**
+     * Extract a single frame of the pattern
+     * \param frame Frame index
+     * \return Return a single-frame pattern
+     */
+    DynamicPattern getFrame(const size_t frame) const
     {
-        const double pi2 = 2.0 * M_PI;
-        const double invS = 1.0 / static_cast<double>(size);
-        double angle, cosA;
+        assert(frame < _frames);
+        DynamicPattern pattern(_width, _height, _dims, 1, 0);
+        std::memcpy(pattern._data.get(), &_data[getOffset(0, 0, frame)], pattern.getCount() * sizeof(float));
+        return pattern;
+    }
+
+    /**
+     * Expand the pattern to a larger size, preserving the ranks of its values
+     * The expanded pattern holds new white noise values. The pixels covering a pixel of this
+     * pattern are spread at random over the four quarters of the value range, and ranked as
+     * the pixel they cover within each quarter. The large scale structure of the pattern is
+     * kept for every threshold, and only has to be refined at the new resolution.
+     * \param width Width of the expanded pattern
+     * \param height Height of the expanded pattern
+     * \param seed Seed of the new values, and of the tie breaking
+     * \return Return the expanded pattern
+     */
+    DynamicPattern getExpanded(const size_t width, const size_t height, const std::mt19937::result_type seed) const
+    {
+        assert(width >= _width && height >= _height);
+
+        DynamicPattern pattern(width, height, _dims, _frames, seed);
+        std::mt19937 rgen(seed);
+        std::uniform_real_distribution<float> dist(0.f, 1.f);
 
-        // FT along X
-        std::array<double, _count> fourierX;
-        for (size_t y = 0; y < size; ++y)
+        const auto count = width * height;
+        std::vector<float> values(count);
+        std::vector<std::pair<float, float>> keys(count);
+        std::vector<size_t> order(count);
+        std::vector<std::array<int, 4>> blockQuarters(_width * _height, {0, 1, 2, 3});
+        for (size_t frame = 0; frame < _frames; ++frame)
         {
-            for (size_t x = 0; x < size; ++x)
+            for (size_t c = 0; c < _dims; ++c)
             {
-                for (size_t c = 0; c < dims; ++c)
-                {
-                    auto index = ((y * size) + x) * dims + c;
-                    fourierX[index] = 0.f;
+                for (auto& quarters : blockQuarters)
+                    std::shuffle(quarters.begin(), quarters.end(), rgen);
 
-                    for (size_t xx = 0; xx < size; ++xx)
-                    {
-                        angle = pi2 * x * xx * invS;
-                        cosA = cos(angle);
-                        fourierX[index] += _data[((y * size) + xx) * dims + c] * cosA;
-                    }
-                    fourierX[index] *= invS;
+                for (size_t i = 0; i < count; ++i)
+                {
+                    const auto x = (i % width) * _width / width;
+                    const auto y = (i / width) * _height / height;
+                    const auto subX = 2 * ((i % width) * _width % width) / width;
+                    const auto subY = 2 * ((i / width) * _height % height) / height;
+                    const auto quarter = blockQuarters[y * _width + x][subY * 2 + subX];
+                    keys[i] = {static_cast<float>(quarter) + _data[getOffset(x, y, frame) + c], dist(rgen)};
+                    values[i] = pattern._data[pattern.getOffset(0, 0, frame) + i * _dims + c];
+                    order[i] = i;
                 }
+
+                std::sort(values.begin(), values.end());
+                std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return keys[a] < keys[b]; });
+                for (size_t rank = 0; rank < count; ++rank)
+                    pattern._data[pattern.getOffset(0, 0, frame) + order[rank] * _dims + c] = values[rank];
             }
         }
 
-        // FT along Y
-        std::array<double, _count> fourierY;
-        for (size_t x = 0; x < size; ++x)
+        return pattern;
+    }
+
+    /**
+     * Get the values of a frame, converted to the given sample type
+     * Integer samples map [0, 1] to their whole range, rounding to nearest.
+     * \param samples Output samples, holding width * height * dims values
+     * \param frame Frame index
+     */
+    template <class S>
+    void getSamples(S* samples, const size_t frame = 0) const
+    {
+        assert(frame < _frames);
+        const float* values = &_data[getOffset(0, 0, frame)];
+        const auto count = _width * _height * _dims;
+        if constexpr (std::is_floating_point_v<S>)
+        {
+            for (size_t i = 0; i < count; ++i)
+                samples[i] = static_cast<S>(values[i]);
+        }
+        else
         {
-            for (size_t y = 0; y < size; ++y)
+            const auto maxValue = static_cast<float>(std::numeric_limits<S>::max());
+            for (size_t i = 0; i < count; ++i)
+                samples[i] = static_cast<S>(std::lround(std::clamp(values[i], 0.f, 1.f) * maxValue));
+        }
+    }
+
+    /**
+     * Power spectrum of a pattern
+     */
+    struct Spectrum
+    {
+        size_t width{0};
+        size_t height{0};
+        std::vector<double> power{};       //!< 2D power spectrum averaged over channels, with the zero frequency at the center
+        std::vector<double> frequencies{}; //!< Center frequency of each radial bin, in cycles per pixel
+        std::vector<double> radialPower{}; //!< Radially averaged power spectrum
+        std::vector<double> anisotropy{};  //!< Variance of the power within each radial bin, relative to its squared mean
+    };
+
+    /**
+     * Compute the power spectrum of this pattern, or of its first frame
+     * Each channel has its mean removed before being transformed, so the
+     * zero frequency is always null.
+     * \return Return the spectrum
+     */
+    Spectrum getSpectrum() const
+    {
+        Spectrum spectrum;
+        spectrum.width = _width;
+        spectrum.height = _height;
+        spectrum.power.assign(_width * _height, 0.0);
+
+        const FFT fftX(_width);
+        const FFT fftY(_height);
+        std::vector<FFT::Complex> values(_width * _height);
+        std::vector<FFT::Complex> column(_height);
+        const auto pixelCount = static_cast<double>(_width * _height);
+
+        for (size_t c = 0; c < _dims; ++c)
+        {
+            double mean = 0.0;
+            for (size_t i = 0; i < _width * _height; ++i)
+                mean += _data[i * _dims + c];
+            mean /= pixelCount;
+
+            for (size_t i = 0; i < _width * _height; ++i)
+                values[i] = FFT::Complex(_data[i * _dims + c] - mean, 0.0);
+
+            for (size_t y = 0; y < _height; ++y)
+                fftX.transform(&values[y * _width]);
+
+            for (size_t x = 0; x < _width; ++x)
             {
-                for (size_t c = 0; c < dims; ++c)
-                {
-                    auto index = ((y * size) + x) * dims + c;
-                    fourierY[index] = 0.f;
+                for (size_t y = 0; y < _height; ++y)
+                    column[y] = values[y * _width + x];
+                fftY.transform(column.data());
 
-                    for (size_t yy = 0; yy < size; ++yy)
-                    {
-                        angle = pi2 * y * yy * invS;
-                        cosA = cos(angle);
-                        fourierY[index] += fourierX[((y * size) + yy) * dims + c] * cosA;
-                    }
-                    fourierY[index] *= invS;
+                // Shift the zero frequency to the center while accumulating the power
+                const auto shiftedX = (x + _width / 2) % _width;
+                for (size_t y = 0; y < _height; ++y)
+                {
+                    const auto shiftedY = (y + _height / 2) % _height;
+                    spectrum.power[shiftedY * _width + shiftedX] += std::norm(column[y]) / (pixelCount * static_cast<double>(_dims));
                 }
             }
         }
 
-        // Combine both dimensions
-        std::array<double, _count> fourier2D;
-        double maxValue = 0.f;
-        for (size_t y = 0; y < size; ++y)
+        // Radial average, with bins one frequency step wide along the largest side
+        const auto side = static_cast<double>(std::max(_width, _height));
+        const auto binCount = static_cast<size_t>(std::ceil(side * std::sqrt(0.5))) + 1;
+        std::vector<double> sqPower(binCount, 0.0);
+        std::vector<size_t> counts(binCount, 0);
+        spectrum.radialPower.assign(binCount, 0.0);
+        for (size_t y = 0; y < _height; ++y)
         {
-            for (size_t x = 0; x < size; ++x)
+            for (size_t x = 0; x < _width; ++x)
             {
-                for (size_t c = 0; c < dims; ++c)
-                {
-                    auto index = ((y * size) + x) * dims + c;
-                    fourier2D[index] = fourierX[((y * size) + x) * dims + c];
-                    fourier2D[index] *= fourierY[((y * size) + x) * dims + c];
-                    maxValue = std::max(maxValue, fourier2D[index]);
-                }
+                const auto fx = (static_cast<double>(x) - static_cast<double>(_width / 2)) / static_cast<double>(_width);
+                const auto fy = (static_cast<double>(y) - static_cast<double>(_height / 2)) / static_cast<double>(_height);
+                const auto bin = std::min(static_cast<size_t>(std::lround(std::sqrt(fx * fx + fy * fy) * side)), binCount - 1);
+                const auto power = spectrum.power[y * _width + x];
+                spectrum.radialPower[bin] += power;
+                sqPower[bin] += power * power;
+                ++counts[bin];
             }
         }
 
-        // Save to file
-        std::array<uint8_t, _count> imgData;
-        for (size_t y = 0; y < size; ++y)
-            for (size_t x = 0; x < size; ++x)
-                for (size_t c = 0; c < dims; ++c)
-                    imgData[(y * size) + x] = static_cast<uint8_t>(255.0 / maxValue * fourier2D[((y * size) + x) * dims + c]);
-        stbi_write_png(filename.c_str(), size, size, 1, imgData.data(), size);
+        for (size_t bin = 0; bin < binCount; ++bin)
+        {
+            if (counts[bin] == 0)
+                continue;
+
+            const auto mean = spectrum.radialPower[bin] / static_cast<double>(counts[bin]);
+            const auto variance = std::max(0.0, sqPower[bin] / static_cast<double>(counts[bin]) - mean * mean);
+            spectrum.frequencies.push_back(static_cast<double>(bin) / side);
+            spectrum.radialPower[spectrum.frequencies.size() - 1] = mean;
+            spectrum.anisotropy.push_back(mean > 0.0 ? variance / (mean * mean) : 0.0);
+        }
+        spectrum.radialPower.resize(spectrum.frequencies.size());
+
+        return spectrum;
+    }
+
+    /**
+     * Generate the magnitude spectrum for this pattern, or its first frame, and save it as an image
+     * The zero frequency is at the center of the image.
+     * \param filename Path to save the spectrum to
+     */
+    void saveFourier(const std::string& filename) const
+    {
+        const auto spectrum = getSpectrum();
+
+        double maxValue = 0.0;
+        for (const auto power : spectrum.power)
+            maxValue = std::max(maxValue, std::sqrt(power));
+
+        std::vector<uint8_t> imgData(_width * _height, 0);
+        if (maxValue > 0.0)
+            for (size_t i = 0; i < _width * _height; ++i)
+                imgData[i] = static_cast<uint8_t>(255.0 / maxValue * std::sqrt(spectrum.power[i]));
+        stbi_write_png(filename.c_str(), _width, _height, 1, imgData.data(), _width);
+    }
+
+    /**
+     * Save the radially averaged power spectrum and anisotropy of this pattern, or of its first frame, as CSV
+     * \param filename Path to save the spectrum to
+     * \return Return true if all went well
+     */
+    bool saveSpectrum(const std::string& filename) const
+    {
+        std::ofstream file(filename);
+        if (!file)
+            return false;
+
+        const auto spectrum = getSpectrum();
+        file << "frequency,power,anisotropy\n";
+        for (size_t bin = 0; bin < spectrum.frequencies.size(); ++bin)
+            file << spectrum.frequencies[bin] << "," << spectrum.radialPower[bin] << "," << spectrum.anisotropy[bin] << "\n";
+        return static_cast<bool>(file);
     }
 
     /**
      * Get the pattern's energy as detailed in "Blue-noise Dithered Sampling", Iliyan et a.
-     * \param pattern Pattern to compute the energy from
      * \param sigma_i Sigma_i, per the article
      * \param sigma_s Sigma_s, per the article
      * \return Return the energy
      */
-    float getEnergy(const float sigma_i = 2.1f, const float sigma_s = 1.f) const
+    double getEnergy(const float sigma_i = 2.1f, const float sigma_s = 1.f) const { return getEnergy(getFullRangeKernel(sigma_i, sigma_s)); }
+
+    /**
+     * Get the pattern's energy, using the given kernel
+     * Only pairs of pixels within the kernel radius are evaluated, so for a fixed
+     * radius the cost is linear in the pixel count.
+     * If a thread pool is given, rows are distributed among its threads. Partial sums
+     * are reduced in row order, so that the result does not depend on the thread count.
+     * \param kernel Energy kernel
+     * \param pool Thread pool to run on, or nullptr to run on the calling thread
+     * \return Return the energy
+     */
+    double getEnergy(const EnergyKernel& kernel, ThreadPool* pool = nullptr) const
     {
-        const float sqSigma_i = sigma_i * sigma_i;
-        const float sqSigma_s = sigma_s * sigma_s;
+        switch (_dims)
+        {
+        case 1:
+            return getEnergyImpl<1>(kernel, pool);
+        case 2:
+            return getEnergyImpl<2>(kernel, pool);
+        case 3:
+            return getEnergyImpl<3>(kernel, pool);
+        case 4:
+            return getEnergyImpl<4>(kernel, pool);
+        default:
+            return getEnergyImpl<0>(kernel, pool);
+        }
+    }
 
-        float energy = 0.f;
-        for (size_t yi = 0; yi < size; ++yi)
+    /**
+     * Get the energy variation resulting from swapping two pixels, without modifying the pattern
+     * \param xi X coordinate of the first pixel
+     * \param yi Y coordinate of the first pixel
+     * \param xj X coordinate of the second pixel
+     * \param yj Y coordinate of the second pixel
+     * \param sigma_i Sigma_i, per the article
+     * \param sigma_s Sigma_s, per the article
+     * \return Return the energy of the swapped pattern minus the energy of this pattern
+     */
+    double getSwapEnergyDelta(const size_t xi, const size_t yi, const size_t xj, const size_t yj, const float sigma_i = 2.1f, const float sigma_s = 1.f) const
+    {
+        return getSwapEnergyDelta(xi, yi, xj, yj, getFullRangeKernel(sigma_i, sigma_s));
+    }
+
+    /**
+     * Get the energy variation resulting from swapping two pixels, using the given kernel
+     * \param xi X coordinate of the first pixel
+     * \param yi Y coordinate of the first pixel
+     * \param xj X coordinate of the second pixel
+     * \param yj Y coordinate of the second pixel
+     * \param kernel Energy kernel
+     * \return Return the energy of the swapped pattern minus the energy of this pattern
+     */
+    double getSwapEnergyDelta(const size_t xi, const size_t yi, const size_t xj, const size_t yj, const EnergyKernel& kernel) const
+    {
+        return getSwapEnergyDelta(Swap{xi, yi, xj, yj, 0}, kernel);
+    }
+
+    /**
+     * Get the energy variation resulting from swapping two pixels of a frame, using the given kernel
+     * Only the pairs involving one of the two pixels are evaluated, which makes it
+     * proportional to the kernel volume instead of the pixel count squared.
+     * \param move Pixels to swap
+     * \param kernel Energy kernel
+     * \return Return the energy of the swapped pattern minus the energy of this pattern
+     */
+    double getSwapEnergyDelta(const Swap& move, const EnergyKernel& kernel) const
+    {
+        switch (_dims)
         {
-            for (size_t xi = 0; xi < size; ++xi)
+        case 1:
+            return getSwapEnergyDeltaImpl<1>(move, kernel);
+        case 2:
+            return getSwapEnergyDeltaImpl<2>(move, kernel);
+        case 3:
+            return getSwapEnergyDeltaImpl<3>(move, kernel);
+        case 4:
+            return getSwapEnergyDeltaImpl<4>(move, kernel);
+        default:
+            return getSwapEnergyDeltaImpl<0>(move, kernel);
+        }
+    }
+
+    /**
+     * Get whether two swaps interact through the given kernel
+     * Swaps interact if a pixel of one is within the kernel neighbourhood of a pixel of the
+     * other. If they do not, the energy variation of one does not depend on the other being
+     * applied, and their variations add up.
+     * \param first First swap
+     * \param second Second swap
+     * \param kernel Energy kernel
+     * \return Return true if the swaps interact
+     */
+    bool doSwapsInteract(const Swap& first, const Swap& second, const EnergyKernel& kernel) const
+    {
+        int offset;
+        if (!kernel.getOffset(first.frame, second.frame, _frames, kernel.getTemporalRadius(_frames), offset))
+            return false;
+
+        const size_t firstPixels[2][2] = {{first.xi, first.yi}, {first.xj, first.yj}};
+        const size_t secondPixels[2][2] = {{second.xi, second.yi}, {second.xj, second.yj}};
+        for (const auto& p : firstPixels)
+            for (const auto& q : secondPixels)
+                if (kernel.getOffset(p[0], q[0], _width, kernel.getRadius(_width), offset) && kernel.getOffset(p[1], q[1], _height, kernel.getRadius(_height), offset))
+                    return true;
+        return false;
+    }
+
+    /**
+     * Swap the values of two pixels
+     * \param xi X coordinate of the first pixel
+     * \param yi Y coordinate of the first pixel
+     * \param xj X coordinate of the second pixel
+     * \param yj Y coordinate of the second pixel
+     */
+    void swap(const size_t xi, const size_t yi, const size_t xj, const size_t yj) { swap(Swap{xi, yi, xj, yj, 0}); }
+
+    /**
+     * Swap the values of two pixels of a frame
+     * \param move Pixels to swap
+     */
+    void swap(const Swap& move)
+    {
+        assert(move.xi < _width && move.yi < _height);
+        assert(move.xj < _width && move.yj < _height);
+        assert(move.frame < _frames);
+
+        const auto offsetI = getOffset(move.xi, move.yi, move.frame);
+        const auto offsetJ = getOffset(move.xj, move.yj, move.frame);
+        for (size_t c = 0; c < _dims; ++c)
+            std::swap(_data[offsetI + c], _data[offsetJ + c]);
+    }
+
+    /**
+     * Write the pattern to a binary stream, with all its frames
+     * \param stream Output stream
+     * \return Return true if all went well
+     */
+    bool write(std::ostream& stream) const
+    {
+        const uint64_t sizes[] = {_width, _height, _dims, _frames};
+        stream.write(reinterpret_cast<const char*>(sizes), sizeof(sizes));
+        stream.write(reinterpret_cast<const char*>(_data.get()), getCount() * sizeof(float));
+        return stream.good();
+    }
+
+    /**
+     * Read the pattern from a binary stream, as written by write()
+     * The sizes are checked against what is left in the stream, if it is seekable, so that
+     * a corrupt stream does not lead to a huge allocation.
+     * \param stream Input stream
+     * \return Return true if all went well, otherwise the pattern is left in an unspecified state
+     */
+    bool read(std::istream& stream)
+    {
+        uint64_t sizes[4];
+        if (!stream.read(reinterpret_cast<char*>(sizes), sizeof(sizes)))
+            return false;
+
+        uint64_t count = 1;
+        for (const auto size : sizes)
+        {
+            if (size == 0 || count > std::numeric_limits<uint64_t>::max() / sizeof(float) / size)
+                return false;
+            count *= size;
+        }
+
+        const auto position = stream.tellg();
+        if (position != std::istream::pos_type(-1))
+        {
+            stream.seekg(0, std::ios::end);
+            const auto remaining = static_cast<uint64_t>(stream.tellg() - position);
+            stream.seekg(position);
+            if (!stream || count * sizeof(float) > remaining)
+                return false;
+        }
+
+        if (!_data || getCount() != count)
+        {
+            _data = tryAllocate(count);
+            if (!_data)
+                return false;
+        }
+        _width = sizes[0];
+        _height = sizes[1];
+        _dims = sizes[2];
+        _frames = sizes[3];
+        return static_cast<bool>(stream.read(reinterpret_cast<char*>(_data.get()), getCount() * sizeof(float)));
+    }
+
+    /**
+     * Save the first frame of the pattern to disk, as a PNG image
+     * Patterns with up to 4 channels are saved as gray, gray and alpha, RGB or RGBA images.
+     * \param filename Path to save the pattern to
+     * \param bitDepth Bits per channel, either 8 or 16
+     * \return Return true if all went well
+     */
+    bool saveToFile(const std::string& filename, const size_t bitDepth = 8) const
+    {
+        if (_dims > 4)
+            return false;
+
+        if (bitDepth == 8)
+        {
+            std::vector<uint8_t> imgData(_width * _height * _dims);
+            getSamples(imgData.data());
+            return stbi_write_png(filename.c_str(), _width, _height, _dims, imgData.data(), _width * _dims);
+        }
+        else if (bitDepth == 16)
+        {
+            std::vector<uint16_t> imgData(_width * _height * _dims);
+            getSamples(imgData.data());
+            return writePng16(filename, imgData.data());
+        }
+
+        return false;
+    }
+
+  protected:
+    /**
+     * Energy computation, specialized for the given number of channels
+     * \param kernel Energy kernel
+     * \param pool Thread pool to run on, or nullptr to run on the calling thread
+     * \return Return the energy
+     */
+    template <size_t dims>
+    double getEnergyImpl(const EnergyKernel& kernel, ThreadPool* pool) const
+    {
+        // Rows of all frames are processed independently
+        std::vector<double> rowEnergies(_height * _frames);
+        const auto computeRow = [&](size_t row) {
+            const auto yi = row % _height;
+            const auto ti = row / _height;
+            rowEnergies[row] = 0.0;
+            for (size_t xi = 0; xi < _width; ++xi)
             {
-                const float* ps = &_data[(yi * size + xi) * dims];
-                for (size_t yj = 0; yj < size; ++yj)
-                {
-                    for (size_t xj = 0; xj < size; ++xj)
-                    {
-                        if (xi == xj && yi == yj)
-                            continue;
+                // The neighbourhood includes the pixel itself, whose pair energy is 1
+                const float* ps = &_data[getOffset(xi, yi, ti)];
+                rowEnergies[row] += getNeighbourhoodEnergy<dims>(xi, yi, ti, ps, kernel) - 1.0;
+            }
+        };
+
+        if (pool)
+            pool->run(rowEnergies.size(), computeRow);
+        else
+            for (size_t row = 0; row < rowEnergies.size(); ++row)
+                computeRow(row);
+
+        double energy = 0.0;
+        for (const auto rowEnergy : rowEnergies)
+            energy += rowEnergy;
+        return energy;
+    }
+
+    /**
+     * Swap energy variation, specialized for the given number of channels
+     * \param move Pixels to swap
+     * \param kernel Energy kernel
+     * \return Return the energy of the swapped pattern minus the energy of this pattern
+     */
+    template <size_t dims>
+    double getSwapEnergyDeltaImpl(const Swap& move, const EnergyKernel& kernel) const
+    {
+        assert(move.xi < _width && move.yi < _height);
+        assert(move.xj < _width && move.yj < _height);
+        assert(move.frame < _frames);
+
+        if (move.xi == move.xj && move.yi == move.yj)
+            return 0.0;
+
+        const float* ps = &_data[getOffset(move.xi, move.yi, move.frame)];
+        const float* qs = &_data[getOffset(move.xj, move.yj, move.frame)];
+
+        double delta = getNeighbourhoodEnergyDelta<dims>(move.xi, move.yi, move.frame, ps, qs, kernel);
+        delta += getNeighbourhoodEnergyDelta<dims>(move.xj, move.yj, move.frame, qs, ps, kernel);
+
+        // The neighbourhoods include the pixels themselves, and possibly the (i, j) pair which is
+        // left unchanged by the swap. Remove their contributions: 1 - g for each pixel, and
+        // w * (1 - g) for the (i, j) pair seen from each side
+        const double g = getValueWeight<dims>(ps, qs, kernel);
+        delta += 2.0 * (1.0 - g);
+
+        int dx, dy;
+        if (kernel.getOffset(move.xi, move.xj, _width, kernel.getRadius(_width), dx) && kernel.getOffset(move.yi, move.yj, _height, kernel.getRadius(_height), dy))
+            delta -= 2.0 * kernel.getSpatialWeight(dx, dy) * (1.0 - g);
+
+        // Each pair appears twice in the energy, as (i, k) and (k, i)
+        return 2.0 * delta;
+    }
+
+  private:
+    struct Deleter
+    {
+        void operator()(float* ptr) const { std::free(ptr); }
+    };
+
+    static constexpr size_t _alignment{64};
+
+    size_t _width{0};
+    size_t _height{0};
+    size_t _dims{0};
+    size_t _frames{1};
+    std::unique_ptr<float[], Deleter> _data{};
+
+    size_t getCount() const { return _width * _height * _dims * _frames; }
+    size_t getOffset(const size_t x, const size_t y, const size_t frame) const { return ((frame * _height + y) * _width + x) * _dims; }
+
+    static std::mt19937::result_type getRandomSeed()
+    {
+        std::random_device rdevice;
+        return rdevice();
+    }
+
+    /**
+     * Allocate aligned storage for the given number of floats
+     * \return Return the storage, or nullptr if it could not be allocated
+     */
+    static std::unique_ptr<float[], Deleter> tryAllocate(size_t count)
+    {
+        if (count > (std::numeric_limits<size_t>::max() - _alignment) / sizeof(float))
+            return nullptr;
+        const auto bytes = ((count * sizeof(float) + _alignment - 1) / _alignment) * _alignment;
+        return std::unique_ptr<float[], Deleter>(static_cast<float*>(std::aligned_alloc(_alignment, std::max(bytes, _alignment))));
+    }
 
-                        const float* qs = &_data[(yj * size + xj) * dims];
-                        float sqValueDist = 0.f;
-                        for (size_t c = 0; c < dims; ++c)
-                            sqValueDist += pow(ps[c] - qs[c], 2.f);
+    /**
+     * Allocate aligned storage for the given number of floats, as operator new would
+     * \return Return the storage, throwing std::bad_alloc if it could not be allocated
+     */
+    static std::unique_ptr<float[], Deleter> allocate(size_t count)
+    {
+        auto data = tryAllocate(count);
+        if (!data)
+            throw std::bad_alloc();
+        return data;
+    }
+
+    /**
+     * Write 16bpc samples to a PNG file, which stb_image_write does not support
+     * Scanlines are stored unfiltered, with big-endian samples.
+     */
+    bool writePng16(const std::string& filename, const uint16_t* samples) const
+    {
+        static constexpr uint8_t colorTypes[] = {0, 4, 2, 6};
+        const auto rowSize = _width * _dims * 2 + 1;
+
+        std::vector<uint8_t> raw(rowSize * _height, 0);
+        for (size_t y = 0; y < _height; ++y)
+        {
+            for (size_t i = 0; i < _width * _dims; ++i)
+            {
+                const auto sample = samples[y * _width * _dims + i];
+                raw[y * rowSize + 1 + 2 * i] = static_cast<uint8_t>(sample >> 8);
+                raw[y * rowSize + 2 + 2 * i] = static_cast<uint8_t>(sample & 0xff);
+            }
+        }
+
+        int compressedSize = 0;
+        std::unique_ptr<uint8_t, void (*)(void*)> compressed(stbi_zlib_compress(raw.data(), raw.size(), &compressedSize, stbi_write_png_compression_level), std::free);
+        if (!compressed)
+            return false;
+
+        std::ofstream file(filename, std::ios::binary);
+        if (!file.is_open())
+            return false;
+
+        const auto writeUint32 = [](std::vector<uint8_t>& buffer, uint32_t value) {
+            for (int shift = 24; shift >= 0; shift -= 8)
+                buffer.push_back(static_cast<uint8_t>(value >> shift));
+        };
+        const auto writeChunk = [&](const char* type, const uint8_t* chunkData, size_t size) {
+            std::vector<uint8_t> chunk;
+            writeUint32(chunk, size);
+            chunk.insert(chunk.end(), type, type + 4);
+            chunk.insert(chunk.end(), chunkData, chunkData + size);
+            writeUint32(chunk, getCrc32(&chunk[4], size + 4));
+            file.write(reinterpret_cast<const char*>(chunk.data()), chunk.size());
+        };
+
+        static constexpr uint8_t signature[] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+        file.write(reinterpret_cast<const char*>(signature), sizeof(signature));
+
+        std::vector<uint8_t> header;
+        writeUint32(header, _width);
+        writeUint32(header, _height);
+        header.insert(header.end(), {16, colorTypes[_dims - 1], 0, 0, 0});
+        writeChunk("IHDR", header.data(), header.size());
+        writeChunk("IDAT", compressed.get(), compressedSize);
+        writeChunk("IEND", nullptr, 0);
+
+        return file.good();
+    }
+
+    static uint32_t getCrc32(const uint8_t* buffer, size_t size)
+    {
+        uint32_t crc = 0xffffffff;
+        for (size_t i = 0; i < size; ++i)
+        {
+            crc ^= buffer[i];
+            for (int bit = 0; bit < 8; ++bit)
+                crc = (crc >> 1) ^ (0xedb88320 & (0 - (crc & 1)));
+        }
+        return ~crc;
+    }
+
+    EnergyKernel getFullRangeKernel(const float sigma_i, const float sigma_s) const { return EnergyKernel(sigma_i, sigma_s, std::max(_width, _height) - 1, false); }
+
+    /**
+     * Value term of the energy, for a given number of channels, 0 meaning the runtime count
+     */
+    template <size_t dims>
+    float getValueWeight(const float* ps, const float* qs, const EnergyKernel& kernel) const
+    {
+        if constexpr (dims == 0)
+            return kernel.getValueWeight(ps, qs, _dims);
+        else
+            return kernel.getValueWeight<dims>(ps, qs);
+    }
+
+    /**
+     * Call a function for each contiguous span of a row of the neighbourhood of a pixel
+     * Rows are split where they wrap around the pattern borders, and span the neighbouring
+     * frames within the temporal radius of the kernel.
+     * \param xi X coordinate of the pixel
+     * \param yi Y coordinate of the pixel
+     * \param ti Frame of the pixel
+     * \param kernel Energy kernel
+     * \param func Function called with the offset of the first pixel of the span, the spatial weights and the span length
+     */
+    template <class Func>
+    void forEachNeighbourSpan(const size_t xi, const size_t yi, const size_t ti, const EnergyKernel& kernel, const Func& func) const
+    {
+        const auto radiusX = static_cast<int>(kernel.getRadius(_width));
+        const auto radiusY = static_cast<int>(kernel.getRadius(_height));
+        const auto radiusT = static_cast<int>(kernel.getTemporalRadius(_frames));
+        for (int dt = kernel.getFirstOffset(_frames, radiusT); dt <= radiusT; ++dt)
+        {
+            size_t tj;
+            if (!kernel.getNeighbour(ti, dt, _frames, tj))
+                continue;
+
+            for (int dy = kernel.getFirstOffset(_height, radiusY); dy <= radiusY; ++dy)
+            {
+                size_t yj;
+                if (!kernel.getNeighbour(yi, dy, _height, yj))
+                    continue;
 
-                        float localEnergy = -static_cast<float>(std::pow(xi - xj, 2) + std::pow(yi - yj, 2)) / sqSigma_i;
-                        localEnergy -= std::pow(sqValueDist, static_cast<float>(dims) / 2.0) / sqSigma_s;
-                        energy += std::exp(localEnergy);
+                for (int dx = kernel.getFirstOffset(_width, radiusX); dx <= radiusX;)
+                {
+                    size_t xj;
+                    if (!kernel.getNeighbour(xi, dx, _width, xj))
+                    {
+                        ++dx;
+                        continue;
                     }
+
+                    const auto count = std::min(static_cast<size_t>(radiusX - dx + 1), _width - xj);
+                    func(getOffset(xj, yj, tj), kernel.getSpatialWeights(dx, dy, dt), count);
+                    dx += static_cast<int>(count);
                 }
             }
         }
+    }
 
+    /**
+     * Get the energy of the pairs between a pixel with the given values and its neighbourhood
+     * \param xi X coordinate of the pixel
+     * \param yi Y coordinate of the pixel
+     * \param ti Frame of the pixel
+     * \param ps Values of the pixel
+     * \param kernel Energy kernel
+     * \return Return the energy, including the pair of the pixel with the current value at its own location
+     */
+    template <size_t dims>
+    double getNeighbourhoodEnergy(const size_t xi, const size_t yi, const size_t ti, const float* ps, const EnergyKernel& kernel) const
+    {
+        float energy = 0.f;
+        forEachNeighbourSpan(xi, yi, ti, kernel, [&](size_t offset, const float* weights, size_t count) {
+            if constexpr (dims == 0)
+                energy += kernel.getRowEnergy(ps, &_data[offset], weights, count, _dims);
+            else
+                energy += kernel.getRowEnergy<dims>(ps, &_data[offset], weights, count);
+        });
         return energy;
     }
 
     /**
-     * Save the pattern to disk, as an 8bpc image
-     * \param filename Path to save the pattern to
-     * \return Return true if all went well
+     * Get the energy variation of the pairs between a pixel and its neighbourhood,
+     * when its values are replaced
+     * \param xi X coordinate of the pixel
+     * \param yi Y coordinate of the pixel
+     * \param ti Frame of the pixel
+     * \param ps Current values of the pixel
+     * \param qs New values of the pixel
+     * \param kernel Energy kernel
+     * \return Return the energy variation, including the pair of the pixel with its own location
      */
-    bool saveToFile(const std::string& filename)
+    template <size_t dims>
+    double getNeighbourhoodEnergyDelta(const size_t xi, const size_t yi, const size_t ti, const float* ps, const float* qs, const EnergyKernel& kernel) const
     {
-        std::array<uint8_t, _count> imgData;
-        for (size_t y = 0; y < size; ++y)
-            for (size_t x = 0; x < size; ++x)
-                for (size_t c = 0; c < dims; ++c)
-                    imgData[(y * size) + x] = static_cast<uint8_t>(255.f * _data[((y * size) + x) * dims + c]);
-        return stbi_write_png(filename.c_str(), size, size, 1, imgData.data(), size);
+        float delta = 0.f;
+        forEachNeighbourSpan(xi, yi, ti, kernel, [&](size_t offset, const float* weights, size_t count) {
+            if constexpr (dims == 0)
+                delta += kernel.getRowEnergyDelta(ps, qs, &_data[offset], weights, count, _dims);
+            else
+                delta += kernel.getRowEnergyDelta<dims>(ps, qs, &_data[offset], weights, count);
+        });
+        return delta;
     }
+};
 
-  private:
-    static constexpr size_t _count = size * size * dims;
-    std::array<float, _count> _data{};
+/**
+ * Noise pattern with a size and channel count fixed at compile time
+ * This is a front end over DynamicPattern, which selects the energy kernel
+ * specialized for the channel count at compile time.
+ */
+template <size_t size, size_t dims = 1>
+class Pattern : public DynamicPattern
+{
+  public:
+    static_assert(size != 0, "Pattern size must not be zero");
+    static_assert(dims != 0, "Pattern dims must not be zero");
+
+    /**
+     * Constructor, filling the pattern with white noise
+     */
+    Pattern()
+        : DynamicPattern(size, size, dims)
+    {
+    }
+
+    using DynamicPattern::getEnergy;
+    using DynamicPattern::getSwapEnergyDelta;
+
+    /**
+     * Get the pattern's energy, using the given kernel
+     * \param kernel Energy kernel
+     * \param pool Thread pool to run on, or nullptr to run on the calling thread
+     * \return Return the energy
+     */
+    double getEnergy(const EnergyKernel& kernel, ThreadPool* pool = nullptr) const { return getEnergyImpl<dims>(kernel, pool); }
+
+    /**
+     * Get the energy variation resulting from swapping two pixels, using the given kernel
+     * \param xi X coordinate of the first pixel
+     * \param yi Y coordinate of the first pixel
+     * \param xj X coordinate of the second pixel
+     * \param yj Y coordinate of the second pixel
+     * \param kernel Energy kernel
+     * \return Return the energy of the swapped pattern minus the energy of this pattern
+     */
+    double getSwapEnergyDelta(const size_t xi, const size_t yi, const size_t xj, const size_t yj, const EnergyKernel& kernel) const
+    {
+        return getSwapEnergyDeltaImpl<dims>(Swap{xi, yi, xj, yj, 0}, kernel);
+    }
+
+    /**
+     * Get the energy variation resulting from swapping two pixels of a frame, using the given kernel
+     * \param move Pixels to swap
+     * \param kernel Energy kernel
+     * \return Return the energy of the swapped pattern minus the energy of this pattern
+     */
+    double getSwapEnergyDelta(const Swap& move, const EnergyKernel& kernel) const { return getSwapEnergyDeltaImpl<dims>(move, kernel); }
 };
 
 } // namespace bluenoise
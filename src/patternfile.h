@@ -0,0 +1,306 @@
+/*
+ * Copyright (C) 2019 Emmanuel Durand
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Splash is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#pragma once
+
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <limits>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <type_traits>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+#include "./kernel.h"
+#include "./pattern.h"
+
+namespace bluenoise
+{
+
+/**
+ * Binary container for noise patterns
+ * The file holds a 64 bytes header, followed by the raw samples of all frames, row by row
+ * with interleaved channels, as in DynamicPattern. Samples are stored in native byte order,
+ * either as floats or as 16 bits unsigned integers mapping [0, 1] to their whole range.
+ * Files are loaded by mapping them in memory, so that float samples are accessed without
+ * any copy or decoding, and only the pages actually read are loaded.
+ */
+class PatternFile
+{
+  public:
+    enum class SampleType : uint32_t
+    {
+        Float32 = 0,
+        UInt16 = 1
+    };
+
+    struct Header
+    {
+        char magic[4]{'B', 'N', 'P', 'T'};
+        uint32_t version{_version};
+        uint32_t width{0};
+        uint32_t height{0};
+        uint32_t dims{0};
+        uint32_t frames{0};
+        uint32_t sampleType{0};
+        uint32_t dataOffset{0}; //!< Offset of the samples from the start of the file, in bytes
+        uint64_t seed{0};       //!< Master seed of the generation
+        float sigma_i{0.f};
+        float sigma_s{0.f};
+        float sigma_t{0.f};
+        uint32_t radius{0};
+        uint32_t temporalRadius{0};
+        uint32_t toroidal{0};
+    };
+    static_assert(sizeof(Header) == 64, "The pattern file header must be 64 bytes");
+
+  public:
+    /**
+     * Constructor, mapping the given file in memory
+     * \param filename Path to the file
+     */
+    explicit PatternFile(const std::string& filename)
+    {
+        const int fd = open(filename.c_str(), O_RDONLY);
+        if (fd < 0)
+            return;
+
+        struct stat status;
+        if (fstat(fd, &status) == 0 && static_cast<size_t>(status.st_size) >= sizeof(Header))
+        {
+            void* mapping = mmap(nullptr, status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapping != MAP_FAILED)
+            {
+                _mapping = mapping;
+                _mappingSize = status.st_size;
+            }
+        }
+        close(fd);
+
+        if (_mapping && !isHeaderValid())
+            unmap();
+    }
+
+    /**
+     * Destructor
+     */
+    ~PatternFile() { unmap(); }
+
+    PatternFile(const PatternFile&) = delete;
+    PatternFile& operator=(const PatternFile&) = delete;
+
+    PatternFile(PatternFile&& other) noexcept
+        : _mapping(std::exchange(other._mapping, nullptr))
+        , _mappingSize(std::exchange(other._mappingSize, 0))
+    {
+    }
+
+    PatternFile& operator=(PatternFile&& other) noexcept
+    {
+        if (this != &other)
+        {
+            unmap();
+            _mapping = std::exchange(other._mapping, nullptr);
+            _mappingSize = std::exchange(other._mappingSize, 0);
+        }
+        return *this;
+    }
+
+    /**
+     * Save a pattern to a file
+     * \param filename Path to the file
+     * \param pattern Pattern to save, with all its frames
+     * \param sampleType Type of the stored samples
+     * \param kernel Energy kernel the pattern has been generated with
+     * \param seed Master seed the pattern has been generated from
+     * \return Return true if all went well
+     */
+    static bool save(const std::string& filename, const DynamicPattern& pattern, const SampleType sampleType, const EnergyKernel& kernel, const uint64_t seed)
+    {
+        Header header;
+        header.width = pattern.getWidth();
+        header.height = pattern.getHeight();
+        header.dims = pattern.getDims();
+        header.frames = pattern.getFrames();
+        header.sampleType = static_cast<uint32_t>(sampleType);
+        header.dataOffset = sizeof(Header);
+        header.seed = seed;
+        header.sigma_i = kernel.getSigmaI();
+        header.sigma_s = std::sqrt(kernel.getSqSigmaS());
+        header.sigma_t = kernel.getSigmaT();
+        header.radius = kernel.getRadius();
+        header.temporalRadius = kernel.getTemporalRadius();
+        header.toroidal = kernel.isToroidal();
+
+        std::ofstream file(filename, std::ios::binary);
+        if (!file.is_open())
+            return false;
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+        const auto frameCount = static_cast<size_t>(header.width) * header.height * header.dims;
+        for (size_t frame = 0; frame < header.frames; ++frame)
+        {
+            if (sampleType == SampleType::Float32)
+                writeFrame<float>(file, pattern, frame, frameCount);
+            else
+                writeFrame<uint16_t>(file, pattern, frame, frameCount);
+        }
+
+        return file.good();
+    }
+
+    /**
+     * Get whether the file has been loaded successfully
+     * \return Return true if the file is mapped and its header is valid
+     */
+    bool isValid() const { return _mapping != nullptr; }
+
+    /**
+     * Get the header of the file
+     * \return Return the header
+     */
+    const Header& getHeader() const
+    {
+        assert(isValid());
+        return *static_cast<const Header*>(_mapping);
+    }
+
+    size_t getWidth() const { return getHeader().width; }
+    size_t getHeight() const { return getHeader().height; }
+    size_t getDims() const { return getHeader().dims; }
+    size_t getFrames() const { return getHeader().frames; }
+    SampleType getSampleType() const { return static_cast<SampleType>(getHeader().sampleType); }
+
+    /**
+     * Get the raw samples of the file
+     * \return Return a pointer to the samples, which must be of the stored type
+     */
+    template <class S>
+    const S* getSamples() const
+    {
+        assert((std::is_same_v<S, float> && getSampleType() == SampleType::Float32) || (std::is_same_v<S, uint16_t> && getSampleType() == SampleType::UInt16));
+        return reinterpret_cast<const S*>(static_cast<const uint8_t*>(_mapping) + getHeader().dataOffset);
+    }
+
+    /**
+     * Access a pixel of a file holding float samples, without copy
+     * \param x X coordinate
+     * \param y Y coordinate
+     * \param frame Frame index
+     * \return Return a view on the pixel values
+     */
+    DynamicPattern::ConstView operator()(const size_t x, const size_t y, const size_t frame = 0) const
+    {
+        assert(x < getWidth() && y < getHeight() && frame < getFrames());
+        return DynamicPattern::ConstView(&getSamples<float>()[getOffset(x, y, frame)], getDims());
+    }
+
+    /**
+     * Get a pixel value, whatever the sample type
+     * \param x X coordinate
+     * \param y Y coordinate
+     * \param channel Channel index
+     * \param frame Frame index
+     * \return Return the value, in [0, 1] for integer samples
+     */
+    float getValue(const size_t x, const size_t y, const size_t channel, const size_t frame = 0) const
+    {
+        assert(x < getWidth() && y < getHeight() && channel < getDims() && frame < getFrames());
+        const auto offset = getOffset(x, y, frame) + channel;
+        if (getSampleType() == SampleType::Float32)
+            return getSamples<float>()[offset];
+        return static_cast<float>(getSamples<uint16_t>()[offset]) / static_cast<float>(std::numeric_limits<uint16_t>::max());
+    }
+
+    /**
+     * Copy the content of the file to a pattern
+     * \return Return the pattern
+     */
+    DynamicPattern toPattern() const
+    {
+        DynamicPattern pattern(getWidth(), getHeight(), getDims(), getFrames(), 0);
+        const auto count = getWidth() * getHeight() * getDims() * getFrames();
+        if (getSampleType() == SampleType::Float32)
+        {
+            std::memcpy(pattern.data(), getSamples<float>(), count * sizeof(float));
+        }
+        else
+        {
+            const auto samples = getSamples<uint16_t>();
+            for (size_t i = 0; i < count; ++i)
+                pattern.data()[i] = static_cast<float>(samples[i]) / static_cast<float>(std::numeric_limits<uint16_t>::max());
+        }
+        return pattern;
+    }
+
+  private:
+    static constexpr uint32_t _version{1};
+
+    void* _mapping{nullptr};
+    size_t _mappingSize{0};
+
+    size_t getOffset(const size_t x, const size_t y, const size_t frame) const { return ((frame * getHeight() + y) * getWidth() + x) * getDims(); }
+
+    bool isHeaderValid() const
+    {
+        const auto& header = getHeader();
+        if (std::memcmp(header.magic, Header().magic, sizeof(header.magic)) != 0 || header.version != _version)
+            return false;
+        // The mapping is page aligned, so samples are aligned as long as their offset is
+        if (header.sampleType > static_cast<uint32_t>(SampleType::UInt16) || header.dataOffset < sizeof(Header) || header.dataOffset % sizeof(float) != 0)
+            return false;
+        if (header.dataOffset > _mappingSize)
+            return false;
+
+        // Sizes come from the file, so their product is checked for overflow at each step
+        const size_t sampleSize = header.sampleType == static_cast<uint32_t>(SampleType::Float32) ? sizeof(float) : sizeof(uint16_t);
+        size_t size = sampleSize;
+        for (const size_t factor : {header.width, header.height, header.dims, header.frames})
+        {
+            if (factor == 0 || size > std::numeric_limits<size_t>::max() / factor)
+                return false;
+            size *= factor;
+        }
+        return size <= _mappingSize - header.dataOffset;
+    }
+
+    void unmap()
+    {
+        if (_mapping)
+            munmap(_mapping, _mappingSize);
+        _mapping = nullptr;
+        _mappingSize = 0;
+    }
+
+    template <class S>
+    static void writeFrame(std::ofstream& file, const DynamicPattern& pattern, const size_t frame, const size_t count)
+    {
+        std::vector<S> samples(count);
+        pattern.getSamples(samples.data(), frame);
+        file.write(reinterpret_cast<const char*>(samples.data()), count * sizeof(S));
+    }
+};
+
+} // namespace bluenoise
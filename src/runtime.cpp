@@ -0,0 +1,65 @@
+/*
+ * Copyright (C) 2019 Emmanuel Durand
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Splash is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "./runtime.h"
+
+#include "./patternfile.h"
+
+namespace bluenoise
+{
+
+/*************/
+NoiseCache& NoiseCache::getInstance()
+{
+    static NoiseCache instance;
+    return instance;
+}
+
+/*************/
+std::shared_ptr<const NoiseTexture> NoiseCache::load(const std::string& filename)
+{
+    // The lock is held while loading, so that a file is only ever loaded once
+    std::lock_guard<std::mutex> lock(_mutex);
+    const auto textureIt = _textures.find(filename);
+    if (textureIt != _textures.end())
+        return textureIt->second;
+
+    const PatternFile file(filename);
+    if (!file.isValid())
+        return nullptr;
+
+    const auto texture = std::make_shared<const NoiseTexture>(file.toPattern());
+    _textures[filename] = texture;
+    return texture;
+}
+
+/*************/
+void NoiseCache::clear()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _textures.clear();
+}
+
+/*************/
+size_t NoiseCache::size() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _textures.size();
+}
+
+} // namespace bluenoise
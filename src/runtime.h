@@ -0,0 +1,298 @@
+/*
+ * Copyright (C) 2019 Emmanuel Durand
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Splash is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "./pattern.h"
+#include "./simd.h"
+
+namespace bluenoise
+{
+
+/**
+ * Read-only noise texture, meant to be sampled at runtime
+ * Lookups are toroidal along all axes, frames included. Each channel of each frame
+ * is ranked once, at construction, into planar rank and threshold arrays, along with
+ * the pixel order used for progressive sampling.
+ */
+class NoiseTexture
+{
+  public:
+    /**
+     * Constructor
+     * \param pattern Pattern to sample
+     */
+    explicit NoiseTexture(DynamicPattern pattern)
+        : _pattern(std::move(pattern))
+    {
+        const auto pixelCount = _pattern.getWidth() * _pattern.getHeight();
+        assert(pixelCount <= std::numeric_limits<uint32_t>::max());
+
+        const auto planeCount = _pattern.getFrames() * _pattern.getDims();
+        _thresholds.resize(planeCount * pixelCount);
+        _ranks.resize(planeCount * pixelCount);
+        _order.resize(planeCount * pixelCount);
+
+        for (size_t frame = 0; frame < _pattern.getFrames(); ++frame)
+        {
+            for (size_t c = 0; c < _pattern.getDims(); ++c)
+            {
+                const auto plane = (frame * _pattern.getDims() + c) * pixelCount;
+                const auto values = _pattern.data() + (frame * pixelCount) * _pattern.getDims() + c;
+                const auto order = &_order[plane];
+
+                // Ties are ranked by pixel index, so that quantized patterns still get a total order
+                std::iota(order, order + pixelCount, 0);
+                std::stable_sort(order, order + pixelCount, [&](const uint32_t lhs, const uint32_t rhs) { return values[lhs * _pattern.getDims()] < values[rhs * _pattern.getDims()]; });
+
+                for (size_t rank = 0; rank < pixelCount; ++rank)
+                {
+                    _ranks[plane + order[rank]] = static_cast<uint32_t>(rank);
+                    _thresholds[plane + order[rank]] = (static_cast<float>(rank) + 0.5f) / static_cast<float>(pixelCount);
+                }
+            }
+        }
+    }
+
+    size_t getWidth() const { return _pattern.getWidth(); }
+    size_t getHeight() const { return _pattern.getHeight(); }
+    size_t getDims() const { return _pattern.getDims(); }
+    size_t getFrames() const { return _pattern.getFrames(); }
+
+    /**
+     * Get the underlying pattern
+     * \return Return the pattern
+     */
+    const DynamicPattern& getPattern() const { return _pattern; }
+
+    /**
+     * Access a pixel, wrapping the coordinates around the texture
+     * \param x X coordinate
+     * \param y Y coordinate
+     * \param frame Frame index
+     * \return Return a view on the pixel values
+     */
+    DynamicPattern::ConstView operator()(const int64_t x, const int64_t y, const int64_t frame = 0) const
+    {
+        return _pattern(wrap(x, getWidth()), wrap(y, getHeight()), wrap(frame, getFrames()));
+    }
+
+    /**
+     * Get a pixel value, wrapping the coordinates around the texture
+     * \param x X coordinate
+     * \param y Y coordinate
+     * \param channel Channel index
+     * \param frame Frame index
+     * \return Return the value
+     */
+    float getValue(const int64_t x, const int64_t y, const size_t channel = 0, const int64_t frame = 0) const
+    {
+        assert(channel < getDims());
+        return (*this)(x, y, frame)[channel];
+    }
+
+    /**
+     * Get the rank of a pixel among the pixels of its channel and frame
+     * \param x X coordinate
+     * \param y Y coordinate
+     * \param channel Channel index
+     * \param frame Frame index
+     * \return Return the rank, in [0, width * height)
+     */
+    uint32_t getRank(const int64_t x, const int64_t y, const size_t channel = 0, const int64_t frame = 0) const
+    {
+        return getRanks(channel, frame)[wrap(y, getHeight()) * getWidth() + wrap(x, getWidth())];
+    }
+
+    /**
+     * Get the threshold of a pixel, which is its rank mapped to [0, 1)
+     * \param x X coordinate
+     * \param y Y coordinate
+     * \param channel Channel index
+     * \param frame Frame index
+     * \return Return the threshold
+     */
+    float getThreshold(const int64_t x, const int64_t y, const size_t channel = 0, const int64_t frame = 0) const
+    {
+        return getThresholds(channel, frame)[wrap(y, getHeight()) * getWidth() + wrap(x, getWidth())];
+    }
+
+    /**
+     * Get the ranks of a channel of a frame, row after row
+     * \param channel Channel index
+     * \param frame Frame index, wrapped around the frame count
+     * \return Return a pointer to width * height ranks
+     */
+    const uint32_t* getRanks(const size_t channel = 0, const int64_t frame = 0) const { return &_ranks[getPlane(channel, frame)]; }
+
+    /**
+     * Get the thresholds of a channel of a frame, row after row
+     * \param channel Channel index
+     * \param frame Frame index, wrapped around the frame count
+     * \return Return a pointer to width * height thresholds
+     */
+    const float* getThresholds(const size_t channel = 0, const int64_t frame = 0) const { return &_thresholds[getPlane(channel, frame)]; }
+
+    /**
+     * Get the pixels of a channel of a frame, sorted by rank
+     * Taking the first n pixels gives a well distributed set of n samples, which
+     * grows progressively with n.
+     * \param channel Channel index
+     * \param frame Frame index, wrapped around the frame count
+     * \return Return a pointer to width * height pixel indices, computed as y * width + x
+     */
+    const uint32_t* getOrder(const size_t channel = 0, const int64_t frame = 0) const { return &_order[getPlane(channel, frame)]; }
+
+    /**
+     * Copy the thresholds of a scanline, wrapping around the texture as needed
+     * \param x X coordinate of the first pixel
+     * \param y Y coordinate
+     * \param channel Channel index
+     * \param frame Frame index
+     * \param count Pixel count
+     * \param thresholds Output thresholds, of at least count elements
+     */
+    void getThresholds(const int64_t x, const int64_t y, const size_t channel, const int64_t frame, const size_t count, float* thresholds) const
+    {
+        forEachSpan(x, y, channel, frame, count, [&](const float* row, const size_t offset, const size_t span) { std::memcpy(thresholds + offset, row, span * sizeof(float)); });
+    }
+
+    /**
+     * Threshold a scanline of values against the texture
+     * \param values Input values, in [0, 1]
+     * \param x X coordinate of the first pixel
+     * \param y Y coordinate
+     * \param channel Channel index
+     * \param frame Frame index
+     * \param count Pixel count
+     * \param output Output, set to 1 where the value is above the threshold and to 0 elsewhere
+     */
+    void dither(const float* values, const int64_t x, const int64_t y, const size_t channel, const int64_t frame, const size_t count, uint8_t* output) const
+    {
+        using simd::FloatPack;
+
+        forEachSpan(x, y, channel, frame, count, [&](const float* row, const size_t offset, const size_t span) {
+            size_t i = 0;
+            for (; i + FloatPack::width <= span; i += FloatPack::width)
+            {
+                const auto mask = FloatPack::greaterMask(FloatPack::load(values + offset + i), FloatPack::load(row + i));
+                for (size_t lane = 0; lane < FloatPack::width; ++lane)
+                    output[offset + i + lane] = (mask >> lane) & 1;
+            }
+            for (; i < span; ++i)
+                output[offset + i] = values[offset + i] > row[i];
+        });
+    }
+
+  private:
+    DynamicPattern _pattern;
+    std::vector<float> _thresholds{};
+    std::vector<uint32_t> _ranks{};
+    std::vector<uint32_t> _order{};
+
+    /**
+     * Wrap a coordinate around an axis, with a mask for power-of-two lengths
+     */
+    static size_t wrap(const int64_t value, const size_t length)
+    {
+        if ((length & (length - 1)) == 0)
+            return static_cast<size_t>(value) & (length - 1);
+        const auto remainder = value % static_cast<int64_t>(length);
+        return static_cast<size_t>(remainder < 0 ? remainder + static_cast<int64_t>(length) : remainder);
+    }
+
+    size_t getPlane(const size_t channel, const int64_t frame) const
+    {
+        assert(channel < getDims());
+        return (wrap(frame, getFrames()) * getDims() + channel) * getWidth() * getHeight();
+    }
+
+    /**
+     * Split a scanline into spans which do not wrap around the texture
+     * \param func Function called with the thresholds of the span, its offset in the scanline and its length
+     */
+    template <class F>
+    void forEachSpan(const int64_t x, const int64_t y, const size_t channel, const int64_t frame, const size_t count, const F& func) const
+    {
+        const auto row = getThresholds(channel, frame) + wrap(y, getHeight()) * getWidth();
+        auto xi = wrap(x, getWidth());
+        for (size_t offset = 0; offset < count;)
+        {
+            const auto span = std::min(count - offset, getWidth() - xi);
+            func(row + xi, offset, span);
+            offset += span;
+            xi = 0;
+        }
+    }
+};
+
+/**
+ * Process-wide cache of noise textures, loaded from pattern files
+ * Textures are shared between callers and stay alive as long as they are used,
+ * even after the cache is cleared.
+ */
+class NoiseCache
+{
+  public:
+    /**
+     * Get the cache instance
+     * \return Return the cache
+     */
+    static NoiseCache& getInstance();
+
+    NoiseCache(const NoiseCache&) = delete;
+    NoiseCache& operator=(const NoiseCache&) = delete;
+
+    /**
+     * Get a texture from a pattern file, loading it on first use
+     * \param filename Pattern file, as written with PatternFile::save
+     * \return Return the texture, or nullptr if the file could not be loaded
+     */
+    std::shared_ptr<const NoiseTexture> load(const std::string& filename);
+
+    /**
+     * Drop all the textures from the cache
+     */
+    void clear();
+
+    /**
+     * Get the number of textures in the cache
+     * \return Return the texture count
+     */
+    size_t size() const;
+
+  private:
+    mutable std::mutex _mutex{};
+    std::unordered_map<std::string, std::shared_ptr<const NoiseTexture>> _textures{};
+
+    NoiseCache() = default;
+};
+
+} // namespace bluenoise
@@ -0,0 +1,289 @@
+/*
+ * Copyright (C) 2019 Emmanuel Durand
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Splash is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__AVX2__) && defined(__FMA__)
+#define BLUENOISE_SIMD_AVX2
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#define BLUENOISE_SIMD_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace bluenoise
+{
+namespace simd
+{
+
+// Code built for different instruction sets gets different symbols, so that translation
+// units compiled with different flags can be linked together, as with the runtime library
+#if defined(BLUENOISE_SIMD_AVX2)
+inline namespace avx2
+#elif defined(BLUENOISE_SIMD_SSE2)
+inline namespace sse2
+#else
+inline namespace scalar
+#endif
+{
+
+/**
+ * Get a string describing the instruction set selected at compile time
+ * \return Return the instruction set name
+ */
+inline const char* getInstructionSet()
+{
+#if defined(BLUENOISE_SIMD_AVX2)
+    return "AVX2";
+#elif defined(BLUENOISE_SIMD_SSE2)
+    return "SSE2";
+#else
+    return "scalar";
+#endif
+}
+
+// Constants for the exponential, from the Cephes library
+namespace expf_constants
+{
+constexpr float hi = 88.3762626647949f;
+constexpr float lo = -88.3762626647949f;
+constexpr float log2e = 1.44269504088896341f;
+constexpr float c1 = 0.693359375f;
+constexpr float c2 = -2.12194440e-4f;
+constexpr float p0 = 1.9875691500E-4f;
+constexpr float p1 = 1.3981999507E-3f;
+constexpr float p2 = 8.3334519073E-3f;
+constexpr float p3 = 4.1665795894E-2f;
+constexpr float p4 = 1.6666665459E-1f;
+constexpr float p5 = 5.0000001201E-1f;
+} // namespace expf_constants
+
+#if defined(BLUENOISE_SIMD_AVX2)
+
+/**
+ * Pack of floats, processed in lanes
+ */
+struct FloatPack
+{
+    static constexpr size_t width = 8;
+    __m256 v;
+
+    static FloatPack zero() { return {_mm256_setzero_ps()}; }
+    static FloatPack broadcast(float value) { return {_mm256_set1_ps(value)}; }
+    static FloatPack load(const float* ptr) { return {_mm256_loadu_ps(ptr)}; }
+    void store(float* ptr) const { _mm256_storeu_ps(ptr, v); }
+
+    template <size_t stride>
+    static FloatPack loadStrided(const float* ptr)
+    {
+        if constexpr (stride == 1)
+            return load(ptr);
+        const __m256i indices = _mm256_setr_epi32(0, stride, 2 * stride, 3 * stride, 4 * stride, 5 * stride, 6 * stride, 7 * stride);
+        return {_mm256_i32gather_ps(ptr, indices, 4)};
+    }
+
+    friend FloatPack operator+(FloatPack a, FloatPack b) { return {_mm256_add_ps(a.v, b.v)}; }
+    friend FloatPack operator-(FloatPack a, FloatPack b) { return {_mm256_sub_ps(a.v, b.v)}; }
+    friend FloatPack operator*(FloatPack a, FloatPack b) { return {_mm256_mul_ps(a.v, b.v)}; }
+    static FloatPack fma(FloatPack a, FloatPack b, FloatPack c) { return {_mm256_fmadd_ps(a.v, b.v, c.v)}; }
+    static FloatPack abs(FloatPack a) { return {_mm256_andnot_ps(_mm256_set1_ps(-0.f), a.v)}; }
+    static FloatPack sqrt(FloatPack a) { return {_mm256_sqrt_ps(a.v)}; }
+    static unsigned greaterMask(FloatPack a, FloatPack b) { return _mm256_movemask_ps(_mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ)); }
+
+    static FloatPack exp(FloatPack x)
+    {
+        using namespace expf_constants;
+        x.v = _mm256_min_ps(x.v, _mm256_set1_ps(hi));
+        x.v = _mm256_max_ps(x.v, _mm256_set1_ps(lo));
+
+        __m256 fx = _mm256_fmadd_ps(x.v, _mm256_set1_ps(log2e), _mm256_set1_ps(0.5f));
+        fx = _mm256_floor_ps(fx);
+        x.v = _mm256_fnmadd_ps(fx, _mm256_set1_ps(c1), x.v);
+        x.v = _mm256_fnmadd_ps(fx, _mm256_set1_ps(c2), x.v);
+
+        const __m256 z = _mm256_mul_ps(x.v, x.v);
+        __m256 y = _mm256_set1_ps(p0);
+        y = _mm256_fmadd_ps(y, x.v, _mm256_set1_ps(p1));
+        y = _mm256_fmadd_ps(y, x.v, _mm256_set1_ps(p2));
+        y = _mm256_fmadd_ps(y, x.v, _mm256_set1_ps(p3));
+        y = _mm256_fmadd_ps(y, x.v, _mm256_set1_ps(p4));
+        y = _mm256_fmadd_ps(y, x.v, _mm256_set1_ps(p5));
+        y = _mm256_fmadd_ps(y, z, _mm256_add_ps(x.v, _mm256_set1_ps(1.f)));
+
+        __m256i n = _mm256_cvttps_epi32(fx);
+        n = _mm256_slli_epi32(_mm256_add_epi32(n, _mm256_set1_epi32(0x7f)), 23);
+        return {_mm256_mul_ps(y, _mm256_castsi256_ps(n))};
+    }
+
+    float sum() const
+    {
+        __m128 lo = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+        lo = _mm_add_ps(lo, _mm_movehl_ps(lo, lo));
+        lo = _mm_add_ss(lo, _mm_shuffle_ps(lo, lo, 0x55));
+        return _mm_cvtss_f32(lo);
+    }
+};
+
+#elif defined(BLUENOISE_SIMD_SSE2)
+
+/**
+ * Pack of floats, processed in lanes
+ */
+struct FloatPack
+{
+    static constexpr size_t width = 4;
+    __m128 v;
+
+    static FloatPack zero() { return {_mm_setzero_ps()}; }
+    static FloatPack broadcast(float value) { return {_mm_set1_ps(value)}; }
+    static FloatPack load(const float* ptr) { return {_mm_loadu_ps(ptr)}; }
+    void store(float* ptr) const { _mm_storeu_ps(ptr, v); }
+
+    template <size_t stride>
+    static FloatPack loadStrided(const float* ptr)
+    {
+        if constexpr (stride == 1)
+            return load(ptr);
+        return {_mm_setr_ps(ptr[0], ptr[stride], ptr[2 * stride], ptr[3 * stride])};
+    }
+
+    friend FloatPack operator+(FloatPack a, FloatPack b) { return {_mm_add_ps(a.v, b.v)}; }
+    friend FloatPack operator-(FloatPack a, FloatPack b) { return {_mm_sub_ps(a.v, b.v)}; }
+    friend FloatPack operator*(FloatPack a, FloatPack b) { return {_mm_mul_ps(a.v, b.v)}; }
+    static FloatPack fma(FloatPack a, FloatPack b, FloatPack c) { return {_mm_add_ps(_mm_mul_ps(a.v, b.v), c.v)}; }
+    static FloatPack abs(FloatPack a) { return {_mm_andnot_ps(_mm_set1_ps(-0.f), a.v)}; }
+    static FloatPack sqrt(FloatPack a) { return {_mm_sqrt_ps(a.v)}; }
+    static unsigned greaterMask(FloatPack a, FloatPack b) { return _mm_movemask_ps(_mm_cmpgt_ps(a.v, b.v)); }
+
+    static FloatPack exp(FloatPack x)
+    {
+        using namespace expf_constants;
+        x.v = _mm_min_ps(x.v, _mm_set1_ps(hi));
+        x.v = _mm_max_ps(x.v, _mm_set1_ps(lo));
+
+        // SSE2 has no floor, truncate and correct for negative values
+        __m128 fx = _mm_add_ps(_mm_mul_ps(x.v, _mm_set1_ps(log2e)), _mm_set1_ps(0.5f));
+        __m128 truncated = _mm_cvtepi32_ps(_mm_cvttps_epi32(fx));
+        fx = _mm_sub_ps(truncated, _mm_and_ps(_mm_cmpgt_ps(truncated, fx), _mm_set1_ps(1.f)));
+        x.v = _mm_sub_ps(x.v, _mm_mul_ps(fx, _mm_set1_ps(c1)));
+        x.v = _mm_sub_ps(x.v, _mm_mul_ps(fx, _mm_set1_ps(c2)));
+
+        const __m128 z = _mm_mul_ps(x.v, x.v);
+        __m128 y = _mm_set1_ps(p0);
+        y = _mm_add_ps(_mm_mul_ps(y, x.v), _mm_set1_ps(p1));
+        y = _mm_add_ps(_mm_mul_ps(y, x.v), _mm_set1_ps(p2));
+        y = _mm_add_ps(_mm_mul_ps(y, x.v), _mm_set1_ps(p3));
+        y = _mm_add_ps(_mm_mul_ps(y, x.v), _mm_set1_ps(p4));
+        y = _mm_add_ps(_mm_mul_ps(y, x.v), _mm_set1_ps(p5));
+        y = _mm_add_ps(_mm_mul_ps(y, z), _mm_add_ps(x.v, _mm_set1_ps(1.f)));
+
+        __m128i n = _mm_cvttps_epi32(fx);
+        n = _mm_slli_epi32(_mm_add_epi32(n, _mm_set1_epi32(0x7f)), 23);
+        return {_mm_mul_ps(y, _mm_castsi128_ps(n))};
+    }
+
+    float sum() const
+    {
+        __m128 s = _mm_add_ps(v, _mm_movehl_ps(v, v));
+        s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 0x55));
+        return _mm_cvtss_f32(s);
+    }
+};
+
+#else
+
+/**
+ * Pack of floats, scalar fallback
+ */
+struct FloatPack
+{
+    static constexpr size_t width = 1;
+    float v;
+
+    static FloatPack zero() { return {0.f}; }
+    static FloatPack broadcast(float value) { return {value}; }
+    static FloatPack load(const float* ptr) { return {*ptr}; }
+    void store(float* ptr) const { *ptr = v; }
+
+    template <size_t stride>
+    static FloatPack loadStrided(const float* ptr)
+    {
+        return {*ptr};
+    }
+
+    friend FloatPack operator+(FloatPack a, FloatPack b) { return {a.v + b.v}; }
+    friend FloatPack operator-(FloatPack a, FloatPack b) { return {a.v - b.v}; }
+    friend FloatPack operator*(FloatPack a, FloatPack b) { return {a.v * b.v}; }
+    static FloatPack fma(FloatPack a, FloatPack b, FloatPack c) { return {a.v * b.v + c.v}; }
+    static FloatPack abs(FloatPack a) { return {std::abs(a.v)}; }
+    static FloatPack sqrt(FloatPack a) { return {std::sqrt(a.v)}; }
+    static unsigned greaterMask(FloatPack a, FloatPack b) { return a.v > b.v; }
+    static FloatPack exp(FloatPack x) { return {std::exp(x.v)}; }
+
+    float sum() const { return v; }
+};
+
+#endif
+
+/**
+ * Raise a squared distance to the power dims / 2, specialized for the common dimensions
+ * \param sqDist Squared distance
+ * \return Return sqDist^(dims / 2)
+ */
+template <size_t dims>
+inline FloatPack powHalfDims(const FloatPack sqDist)
+{
+    if constexpr (dims == 1)
+        return FloatPack::sqrt(sqDist);
+    else if constexpr (dims == 2)
+        return sqDist;
+    else if constexpr (dims == 3)
+        return sqDist * FloatPack::sqrt(sqDist);
+    else if constexpr (dims == 4)
+        return sqDist * sqDist;
+    else
+        return powHalfDims<dims - 4>(sqDist) * sqDist * sqDist;
+}
+
+/**
+ * Scalar version of powHalfDims
+ * \param sqDist Squared distance
+ * \return Return sqDist^(dims / 2)
+ */
+template <size_t dims>
+inline float powHalfDims(const float sqDist)
+{
+    if constexpr (dims == 1)
+        return std::sqrt(sqDist);
+    else if constexpr (dims == 2)
+        return sqDist;
+    else if constexpr (dims == 3)
+        return sqDist * std::sqrt(sqDist);
+    else if constexpr (dims == 4)
+        return sqDist * sqDist;
+    else
+        return powHalfDims<dims - 4>(sqDist) * sqDist * sqDist;
+}
+
+} // namespace avx2, sse2 or scalar
+} // namespace simd
+} // namespace bluenoise
@@ -0,0 +1,159 @@
+/*
+ * Copyright (C) 2019 Emmanuel Durand
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Splash is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace bluenoise
+{
+
+/**
+ * Persistent thread pool
+ * Workers are spawned once and sleep between calls to run(), so that it is
+ * cheap enough to be called at every evaluation of the energy.
+ */
+class ThreadPool
+{
+  public:
+    /**
+     * Constructor
+     * \param threadCount Number of threads, including the calling one. 0 to use all hardware threads
+     */
+    explicit ThreadPool(size_t threadCount = 0)
+    {
+        if (threadCount == 0)
+            threadCount = std::max(1u, std::thread::hardware_concurrency());
+
+        for (size_t i = 1; i < threadCount; ++i)
+            _workers.emplace_back([this]() { work(); });
+    }
+
+    /**
+     * Destructor
+     */
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stop = true;
+        }
+        _wakeCondition.notify_all();
+        for (auto& worker : _workers)
+            worker.join();
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    /**
+     * Get the number of threads, including the calling one
+     * \return Return the thread count
+     */
+    size_t getThreadCount() const { return _workers.size() + 1; }
+
+    /**
+     * Call a function for every index in [0, count), and wait for all calls to return
+     * The calling thread takes part in the work. Calls made from within a task are run
+     * serially on the calling thread. The function is called through a pointer to it,
+     * so that nothing is allocated whatever it captures.
+     * \param count Number of tasks
+     * \param func Function to call with each task index
+     */
+    template <class F>
+    void run(const size_t count, const F& func)
+    {
+        if (_workers.empty() || count <= 1 || _isWorker)
+        {
+            for (size_t i = 0; i < count; ++i)
+                func(i);
+            return;
+        }
+
+        std::lock_guard<std::mutex> runLock(_runMutex);
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _task = &func;
+            _invoke = [](const void* task, size_t index) { (*static_cast<const F*>(task))(index); };
+            _taskCount = count;
+            _nextTask = 0;
+            _activeWorkers = _workers.size();
+            ++_generation;
+        }
+        _wakeCondition.notify_all();
+
+        process();
+
+        std::unique_lock<std::mutex> lock(_mutex);
+        _doneCondition.wait(lock, [&]() { return _activeWorkers == 0; });
+        _task = nullptr;
+    }
+
+  private:
+    std::vector<std::thread> _workers{};
+    std::mutex _runMutex{};
+    std::mutex _mutex{};
+    std::condition_variable _wakeCondition{};
+    std::condition_variable _doneCondition{};
+
+    const void* _task{nullptr};
+    void (*_invoke)(const void*, size_t){nullptr};
+    size_t _taskCount{0};
+    std::atomic<size_t> _nextTask{0};
+    size_t _activeWorkers{0};
+    size_t _generation{0};
+    bool _stop{false};
+
+    static inline thread_local bool _isWorker{false};
+
+    void process()
+    {
+        const bool isWorker = _isWorker;
+        _isWorker = true;
+        for (auto index = _nextTask.fetch_add(1); index < _taskCount; index = _nextTask.fetch_add(1))
+            _invoke(_task, index);
+        _isWorker = isWorker;
+    }
+
+    void work()
+    {
+        size_t generation = 0;
+        while (true)
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _wakeCondition.wait(lock, [&]() { return _stop || _generation != generation; });
+            if (_stop)
+                return;
+            generation = _generation;
+            lock.unlock();
+
+            process();
+
+            lock.lock();
+            if (--_activeWorkers == 0)
+                _doneCondition.notify_one();
+        }
+    }
+};
+
+} // namespace bluenoise
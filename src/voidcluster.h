@@ -0,0 +1,243 @@
+/*
+ * Copyright (C) 2019 Emmanuel Durand
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Splash is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <limits>
+#include <random>
+#include <vector>
+
+#include "./kernel.h"
+#include "./pattern.h"
+
+namespace bluenoise
+{
+
+/**
+ * Void-and-cluster dither mask generator, as described in
+ * "The void-and-cluster method for dither array generation", Ulichney
+ * The energy of each pixel is the sum of the spatial term of the energy kernel over
+ * all set pixels. It is updated incrementally when a pixel is set or cleared, and the
+ * extrema of each row are cached, so finding the tightest cluster or the largest void
+ * only scans the rows touched by the last update.
+ */
+class VoidAndCluster
+{
+  public:
+    /**
+     * Constructor
+     * \param width Width of the mask
+     * \param height Height of the mask
+     * \param kernel Energy kernel, of which only the spatial term is used
+     */
+    VoidAndCluster(size_t width, size_t height, const EnergyKernel& kernel)
+        : _width(width)
+        , _height(height)
+        , _kernel(kernel)
+    {
+        assert(width != 0);
+        assert(height != 0);
+    }
+
+    /**
+     * Generate a scalar dither mask
+     * Each pixel holds its rank in the dithering order, mapped to [0, 1).
+     * \param rgen Random generator used for the initial binary pattern
+     * \param initialDensity Density of set pixels in the initial binary pattern
+     * \return Return the mask
+     */
+    DynamicPattern generate(std::mt19937& rgen, const float initialDensity = 0.1f)
+    {
+        const auto count = _width * _height;
+        const auto initialCount = std::clamp<size_t>(static_cast<size_t>(initialDensity * static_cast<float>(count)), 1, std::max<size_t>(count - 1, 1));
+
+        reset();
+
+        // Random initial binary pattern
+        std::vector<size_t> indices(count);
+        for (size_t i = 0; i < count; ++i)
+            indices[i] = i;
+        std::shuffle(indices.begin(), indices.end(), rgen);
+        for (size_t i = 0; i < initialCount; ++i)
+            setPixel(indices[i], true);
+        updateRows(0, _height);
+
+        // Relax it into a blue noise prototype, by moving the tightest cluster
+        // to the largest void until this does not change anything
+        for (size_t i = 0; i < count && initialCount < count; ++i)
+        {
+            const auto cluster = findTightestCluster();
+            setPixel(cluster, false);
+            updateAround(cluster);
+            const auto largestVoid = findLargestVoid();
+            setPixel(largestVoid, true);
+            updateAround(largestVoid);
+            if (largestVoid == cluster)
+                break;
+        }
+
+        const auto prototypeBinary = _binary;
+        const auto prototypeField = _field;
+        std::vector<size_t> ranks(count, 0);
+
+        // Rank the initial pixels by removing the tightest clusters
+        for (size_t rank = initialCount; rank > 0; --rank)
+        {
+            const auto cluster = findTightestCluster();
+            setPixel(cluster, false);
+            updateAround(cluster);
+            ranks[cluster] = rank - 1;
+        }
+
+        // Rank the remaining pixels by filling the largest voids. Past half of the
+        // pixels, the largest void among unset pixels is also the tightest cluster
+        // of unset pixels, so the same criterion holds until the mask is full
+        _binary = prototypeBinary;
+        _field = prototypeField;
+        updateRows(0, _height);
+        for (size_t rank = initialCount; rank < count; ++rank)
+        {
+            const auto largestVoid = findLargestVoid();
+            setPixel(largestVoid, true);
+            updateAround(largestVoid);
+            ranks[largestVoid] = rank;
+        }
+
+        DynamicPattern mask(_width, _height, 1);
+        for (size_t i = 0; i < count; ++i)
+            mask.data()[i] = (static_cast<float>(ranks[i]) + 0.5f) / static_cast<float>(count);
+        return mask;
+    }
+
+  private:
+    static constexpr size_t _none{std::numeric_limits<size_t>::max()};
+
+    size_t _width{0};
+    size_t _height{0};
+    EnergyKernel _kernel;
+
+    std::vector<uint8_t> _binary{};
+    std::vector<float> _field{};
+    std::vector<size_t> _rowCluster{}; //!< Per row, index of the set pixel with the highest energy
+    std::vector<size_t> _rowVoid{};    //!< Per row, index of the unset pixel with the lowest energy
+
+    void reset()
+    {
+        _binary.assign(_width * _height, 0);
+        _field.assign(_width * _height, 0.f);
+        _rowCluster.assign(_height, _none);
+        _rowVoid.assign(_height, _none);
+    }
+
+    /**
+     * Set or clear a pixel, updating the energy field around it
+     * Row extrema are not updated, see updateAround
+     */
+    void setPixel(const size_t index, const bool value)
+    {
+        if (static_cast<bool>(_binary[index]) == value)
+            return;
+        _binary[index] = value;
+
+        const auto sign = value ? 1.f : -1.f;
+        const auto xi = index % _width;
+        const auto yi = index / _width;
+        const auto radiusX = static_cast<int>(_kernel.getRadius(_width));
+        const auto radiusY = static_cast<int>(_kernel.getRadius(_height));
+        for (int dy = _kernel.getFirstOffset(_height, radiusY); dy <= radiusY; ++dy)
+        {
+            size_t yj;
+            if (!_kernel.getNeighbour(yi, dy, _height, yj))
+                continue;
+
+            for (int dx = _kernel.getFirstOffset(_width, radiusX); dx <= radiusX; ++dx)
+            {
+                size_t xj;
+                if (!_kernel.getNeighbour(xi, dx, _width, xj))
+                    continue;
+                _field[yj * _width + xj] += sign * _kernel.getSpatialWeight(dx, dy);
+            }
+        }
+    }
+
+    /**
+     * Update the row extrema around a pixel whose value just changed
+     */
+    void updateAround(const size_t index)
+    {
+        const auto yi = index / _width;
+        const auto radiusY = static_cast<int>(_kernel.getRadius(_height));
+        for (int dy = _kernel.getFirstOffset(_height, radiusY); dy <= radiusY; ++dy)
+        {
+            size_t yj;
+            if (_kernel.getNeighbour(yi, dy, _height, yj))
+                updateRows(yj, yj + 1);
+        }
+    }
+
+    /**
+     * Update the row extrema for the rows in [first, last)
+     */
+    void updateRows(const size_t first, const size_t last)
+    {
+        for (size_t y = first; y < last; ++y)
+        {
+            auto cluster = _none;
+            auto largestVoid = _none;
+            for (size_t index = y * _width; index < (y + 1) * _width; ++index)
+            {
+                if (_binary[index])
+                {
+                    if (cluster == _none || _field[index] > _field[cluster])
+                        cluster = index;
+                }
+                else if (largestVoid == _none || _field[index] < _field[largestVoid])
+                {
+                    largestVoid = index;
+                }
+            }
+            _rowCluster[y] = cluster;
+            _rowVoid[y] = largestVoid;
+        }
+    }
+
+    size_t findTightestCluster() const
+    {
+        auto cluster = _none;
+        for (const auto index : _rowCluster)
+            if (index != _none && (cluster == _none || _field[index] > _field[cluster]))
+                cluster = index;
+        assert(cluster != _none);
+        return cluster;
+    }
+
+    size_t findLargestVoid() const
+    {
+        auto largestVoid = _none;
+        for (const auto index : _rowVoid)
+            if (index != _none && (largestVoid == _none || _field[index] < _field[largestVoid]))
+                largestVoid = index;
+        assert(largestVoid != _none);
+        return largestVoid;
+    }
+};
+
+} // namespace bluenoise